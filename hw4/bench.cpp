@@ -0,0 +1,222 @@
+// bench runs hw4 over generated scenarios of growing size and compares the results with a baseline
+// usage: bench_run [--sim=./hw4_opt] [--gen=./scenario_gen] [--min-nodes=100] [--max-nodes=1000000]
+//                  [--time-limit=sec] [--work=dir] [--baseline=file] [--tolerance=0.2] [--out=file]
+// every size n has n nodes and n traffic pairs (seed 1, binary with adjacency); hw4 runs with
+// --trace=off --stream-traffic --summary=json and the summaries are written as a JSON array
+// a run slower or larger than the baseline by more than the tolerance makes the exit status 1; the
+// baseline should come from the same machine (see make bench-baseline)
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include "option_format.h"
+
+using namespace std;
+
+// the fields of one summary line of hw4; the keys are those of print_summary in hw4.cpp
+const char *const BENCH_KEYS[] = {"nodes", "pairs", "events", "load_sec", "sim_sec", "events_per_sec",
+                                  "peak_pending_events", "peak_live_packets", "peak_rss_kb"};
+
+class bench_result
+{
+public:
+    string status; // "ok", "timeout" or "failed"
+    map<string, double> values;
+
+    // read the numbers of a flat JSON object
+    bool parse(const string &obj)
+    {
+        for (const char *key : BENCH_KEYS)
+        {
+            string quoted = string("\"") + key + "\":";
+            size_t at = obj.find(quoted);
+            if (at == string::npos)
+                continue;
+            values[key] = strtod(obj.c_str() + at + quoted.size(), nullptr);
+        }
+        size_t at = obj.find("\"status\":");
+        if (at != string::npos)
+        {
+            size_t begin = obj.find('"', at + 9) + 1;
+            status = obj.substr(begin, obj.find('"', begin) - begin);
+        }
+        return values.count("nodes") != 0;
+    }
+    string json() const
+    {
+        ostringstream out;
+        out << setprecision(12) << "{\"status\": \"" << status << "\"";
+        for (const char *key : BENCH_KEYS)
+            if (values.count(key) != 0)
+                out << ", \"" << key << "\": " << values.at(key);
+        out << "}";
+        return out.str();
+    }
+    double get(const string &key) const { return values.count(key) != 0 ? values.at(key) : 0; }
+};
+
+class bench_options
+{
+public:
+    string sim, gen, work, baseline, out;
+    unsigned int min_nodes, max_nodes, time_limit;
+    double tolerance;
+    bench_options()
+        : sim("./hw4_opt"), gen("./scenario_gen"), work("/tmp"), min_nodes(100), max_nodes(1000000), time_limit(600),
+          tolerance(0.2)
+    {
+    }
+};
+
+int run(const string &cmd)
+{
+    int status = system(cmd.c_str());
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+bench_result bench_size(const bench_options &o, unsigned int n)
+{
+    bench_result r;
+    r.values["nodes"] = n;
+    string scenario = o.work + "/bench_" + to_string(n) + ".bin", summary = o.work + "/bench_" + to_string(n) + ".json";
+    if (run(o.gen + " --nodes=" + to_string(n) + " --pairs=" + to_string(n) + " --seed=1 --format=binary --adjacency --out=" +
+            scenario) != 0)
+    {
+        r.status = "failed";
+        return r;
+    }
+    int code = run("timeout " + to_string(o.time_limit) + " " + o.sim + " --trace=off --stream-traffic --summary=json --scenario=" +
+                   scenario + " 2> " + summary);
+    ifstream in(summary);
+    string line, last;
+    while (getline(in, line))
+        if (!line.empty() && line[0] == '{')
+            last = line;
+    if (code == 124)
+        r.status = "timeout";
+    else if (code != 0 || !r.parse(last))
+        r.status = "failed";
+    else
+        r.status = "ok";
+    remove(scenario.c_str());
+    remove(summary.c_str());
+    return r;
+}
+
+// the results of a previous run, by number of nodes
+map<unsigned int, bench_result> read_results(const string &path)
+{
+    map<unsigned int, bench_result> results;
+    ifstream in(path);
+    stringstream text;
+    text << in.rdbuf();
+    string s = text.str();
+    for (size_t begin = s.find('{'); begin != string::npos; begin = s.find('{', begin + 1))
+    {
+        bench_result r;
+        if (r.parse(s.substr(begin, s.find('}', begin) - begin + 1)))
+            results[(unsigned int)r.get("nodes")] = r;
+    }
+    return results;
+}
+
+// print how r differs from base; false if it is worse than the tolerance allows
+bool compare(const bench_result &r, const bench_result &base, double tolerance)
+{
+    bool ok = true;
+    cerr << "  " << r.get("nodes") << " nodes: ";
+    if (r.status != "ok" || base.status != "ok")
+    {
+        cerr << r.status << " (baseline " << base.status << ")" << endl;
+        return r.status == "ok" || base.status != "ok";
+    }
+    double speed = r.get("events_per_sec") / base.get("events_per_sec"), rss = r.get("peak_rss_kb") / base.get("peak_rss_kb");
+    cerr << "events/s x" << speed << "   peak RSS x" << rss;
+    if (speed < 1 - tolerance)
+    {
+        cerr << "   SLOWER";
+        ok = false;
+    }
+    if (rss > 1 + tolerance)
+    {
+        cerr << "   MORE MEMORY";
+        ok = false;
+    }
+    // the simulation is deterministic, so these only change with the behavior of hw4
+    if (r.get("events") != base.get("events") || r.get("peak_pending_events") != base.get("peak_pending_events"))
+        cerr << "   (events " << base.get("events") << " -> " << r.get("events") << ", peak pending "
+             << base.get("peak_pending_events") << " -> " << r.get("peak_pending_events") << ")";
+    cerr << endl;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options o;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool bad = false; // a number option with a wrong value
+        if (option_value(arg, "sim", o.sim) || option_value(arg, "gen", o.gen) || option_value(arg, "work", o.work) ||
+            option_value(arg, "baseline", o.baseline) || option_value(arg, "out", o.out))
+            continue;
+        if (!option_number(arg, "min-nodes", o.min_nodes, bad) && !option_number(arg, "max-nodes", o.max_nodes, bad) &&
+            !option_number(arg, "time-limit", o.time_limit, bad) && !option_number(arg, "tolerance", o.tolerance, bad))
+            bad = true;
+        if (bad)
+        {
+            cerr << "usage: " << argv[0] << " [--sim=path] [--gen=path] [--min-nodes=n] [--max-nodes=n] [--time-limit=sec]" << endl
+                 << "       [--work=dir] [--baseline=file] [--tolerance=f] [--out=file]" << endl;
+            return 1;
+        }
+    }
+
+    vector<bench_result> results;
+    bool stopped = false;
+    for (unsigned long long n = o.min_nodes; n <= o.max_nodes; n *= 10)
+    {
+        bench_result r;
+        r.values["nodes"] = n;
+        if (stopped)
+            r.status = "timeout"; // a larger scenario cannot be faster
+        else
+        {
+            cerr << "bench " << n << " nodes ..." << endl;
+            r = bench_size(o, n);
+        }
+        stopped = stopped || r.status != "ok";
+        results.push_back(r);
+    }
+
+    string json = "[\n";
+    for (size_t i = 0; i < results.size(); i++)
+        json += "  " + results[i].json() + (i + 1 < results.size() ? ",\n" : "\n");
+    json += "]\n";
+    if (o.out.empty())
+        cout << json;
+    else
+        ofstream(o.out) << json;
+
+    bool ok = true;
+    if (!o.baseline.empty() && !ifstream(o.baseline))
+        cerr << "no baseline " << o.baseline << " on this machine; write one with make bench-baseline" << endl;
+    else if (!o.baseline.empty())
+    {
+        map<unsigned int, bench_result> base = read_results(o.baseline);
+        cerr << "compared with " << o.baseline << ":" << endl;
+        for (const bench_result &r : results)
+        {
+            if (base.count((unsigned int)r.get("nodes")) != 0)
+                ok = compare(r, base[(unsigned int)r.get("nodes")], o.tolerance) && ok;
+            else
+                cerr << "  " << r.get("nodes") << " nodes: no baseline" << endl;
+        }
+    }
+    return ok ? 0 : 1;
+}
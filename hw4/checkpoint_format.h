@@ -0,0 +1,166 @@
+// the checkpoint written by "hw4 --checkpoint=path --checkpoint-at=time" and read by "hw4 --restore=path"
+//
+// file layout:
+//   checkpoint_file_header
+//   the options the state depends on, the clock and the counters of the simulation
+//   the nodes: their ids, then the state of every node (neighbors, tables, waiting packets)
+//   the traffic pairs scheduled so far and the packet ids kept for the rest, then the pending events
+//   with their packets
+//   CHECKPOINT_END
+// the sections are written by the save() functions of hw4 in the order their load() functions read them;
+// a string, vector or map is its size as uint64_t followed by its elements
+// all integers are stored in the byte order of the machine writing the file
+#ifndef CHECKPOINT_FORMAT_H
+#define CHECKPOINT_FORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <type_traits>
+
+const char CHECKPOINT_MAGIC[8] = {'G', 'R', 'C', 'K', 'P', 'T', '0', '1'};
+const uint32_t CHECKPOINT_VERSION = 7;
+const uint32_t CHECKPOINT_END = 0x444e4521; // written last, so a truncated file is noticed
+
+struct checkpoint_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+class checkpoint_out
+{
+    FILE *f;
+
+public:
+    checkpoint_out(FILE *_f) : f(_f) {}
+
+    template <class T>
+    void put(const T &v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are written as they are");
+        fwrite(&v, sizeof(v), 1, f);
+    }
+    void put(const std::string &s)
+    {
+        put((uint64_t)s.size());
+        fwrite(s.data(), 1, s.size(), f);
+    }
+    template <class A, class B>
+    void put(const std::pair<A, B> &p)
+    {
+        put(p.first);
+        put(p.second);
+    }
+    template <class T>
+    void put(const std::vector<T> &v)
+    {
+        put((uint64_t)v.size());
+        for (size_t i = 0; i < v.size(); i++)
+            put(v[i]);
+    }
+    template <class K, class V>
+    void put(const std::map<K, V> &m)
+    {
+        put((uint64_t)m.size());
+        for (typename std::map<K, V>::const_iterator it = m.begin(); it != m.end(); it++)
+        {
+            put(it->first);
+            put(it->second);
+        }
+    }
+    bool failed() const { return ferror(f) != 0; }
+};
+
+// every get() of a truncated or corrupt file leaves the value unchanged and makes failed() true
+class checkpoint_in
+{
+    FILE *f;
+    uint64_t left; // the bytes not read yet
+    bool error;
+
+    bool read(void *data, uint64_t n)
+    {
+        if (error || n > left || fread(data, 1, n, f) != n)
+            error = true;
+        else
+            left -= n;
+        return !error;
+    }
+    // a size larger than the rest of the file cannot be right
+    bool get_size(uint64_t &n)
+    {
+        get(n);
+        if (!error && n > left)
+            error = true;
+        return !error;
+    }
+
+public:
+    checkpoint_in(FILE *_f) : f(_f), left(0), error(false)
+    {
+        if (fseek(f, 0, SEEK_END) == 0)
+        {
+            long end = ftell(f);
+            left = end > 0 ? end : 0;
+        }
+        rewind(f);
+    }
+
+    template <class T>
+    void get(T &v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are read as they are");
+        read(&v, sizeof(v));
+    }
+    void get(std::string &s)
+    {
+        uint64_t n;
+        if (!get_size(n))
+            return;
+        s.resize(n);
+        if (n != 0)
+            read(&s[0], n);
+    }
+    template <class A, class B>
+    void get(std::pair<A, B> &p)
+    {
+        get(p.first);
+        get(p.second);
+    }
+    template <class T>
+    void get(std::vector<T> &v)
+    {
+        uint64_t n;
+        if (!get_size(n))
+            return;
+        v.resize(n);
+        for (size_t i = 0; i < n; i++)
+            get(v[i]);
+    }
+    template <class K, class V>
+    void get(std::map<K, V> &m)
+    {
+        uint64_t n;
+        if (!get_size(n))
+            return;
+        m.clear();
+        for (uint64_t i = 0; i < n && !error; i++)
+        {
+            K k;
+            V v;
+            get(k);
+            get(v);
+            m[k] = v;
+        }
+    }
+    bool failed() const { return error; }
+    void fail() { error = true; }
+};
+
+#endif
@@ -0,0 +1,239 @@
+// golden compares the event log of a candidate engine or configuration with the one of the reference
+// usage: golden_run [--ref=cmd] [--cand=cmd] [--cand-binary] [--record-with=cmd] [--sample=in] [--scenarios=n]
+//                   [--seed=s] [--nodes=lo:hi] [--context=n] [--max-failures=n] [--gen=path] [--convert=path]
+//                   [--work=dir]
+// every sample .in is run by both commands and checked against its .out; then n scenarios are generated
+// with scenario_gen and the two logs are compared line by line. The first diverging line is printed
+// with the lines before it and the command which regenerates the scenario.
+// with --cand-binary the candidate reads the scenario converted to the binary format
+// with --record-with the dequeue order of cmd is recorded and the candidate replays it. Where the replay
+// diverges it reports that and exits with 3, but still runs to the end; the events of the same time may
+// come in another order than in the reference, so the two logs are compared sorted
+// a run which does not exit with status 0 fails the comparison
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include "option_format.h"
+
+using namespace std;
+
+class golden_options
+{
+public:
+    string ref, cand, gen, convert, work, record_with;
+    vector<string> samples;
+    bool cand_binary;
+    unsigned int scenarios, nodes_lo, nodes_hi, context, max_failures;
+    unsigned long long seed;
+    golden_options()
+        : ref("./hw4"), cand("./hw4_opt"), gen("./scenario_gen"), convert("./scenario_convert"), work("/tmp"),
+          cand_binary(false), scenarios(1000), nodes_lo(10), nodes_hi(150), context(3), max_failures(1), seed(1)
+    {
+    }
+};
+
+int run(const string &cmd)
+{
+    int status = system(cmd.c_str());
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+// the lines of a file without their '\r'; a missing last newline does not count
+vector<string> read_lines(const string &path)
+{
+    vector<string> lines;
+    ifstream in(path);
+    string line;
+    while (getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        lines.push_back(line);
+    }
+    while (!lines.empty() && lines.back().empty())
+        lines.pop_back();
+    return lines;
+}
+
+// true if the logs are equal; otherwise the first difference is printed
+bool same_log(const string &what, const string &ref_name, const vector<string> &ref, const string &cand_name,
+              const vector<string> &cand, unsigned int context)
+{
+    size_t i = 0;
+    while (i < ref.size() && i < cand.size() && ref[i] == cand[i])
+        i++;
+    if (i == ref.size() && i == cand.size())
+        return true;
+    cout << "DIVERGED " << what << " at line " << i + 1 << endl;
+    for (size_t k = (i > context ? i - context : 0); k < i; k++)
+        cout << "    " << ref[k] << endl;
+    for (size_t k = i; k < i + context && k < ref.size(); k++)
+        cout << "  - " << ref[k] << (k == i ? "   <- " + ref_name : "") << endl;
+    if (i >= ref.size())
+        cout << "  - (end of " << ref_name << ")" << endl;
+    for (size_t k = i; k < i + context && k < cand.size(); k++)
+        cout << "  + " << cand[k] << (k == i ? "   <- " + cand_name : "") << endl;
+    if (i >= cand.size())
+        cout << "  + (end of " << cand_name << ")" << endl;
+    return false;
+}
+
+// a splitmix64 generator, so the n-th scenario is the same on every run
+class golden_random
+{
+    unsigned long long state;
+
+public:
+    golden_random(unsigned long long seed) : state(seed) {}
+    unsigned long long next()
+    {
+        unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    unsigned int between(unsigned int lo, unsigned int hi) { return lo + next() % (hi - lo + 1); }
+};
+
+// the options of scenario_gen for the i-th scenario
+string scenario_args(const golden_options &o, unsigned int i)
+{
+    const char *placements[] = {"uniform", "clustered", "grid", "corridor"};
+    const char *traffic[] = {"uniform", "hotspot", "all-to-one"};
+    golden_random rnd(o.seed * 1000003 + i);
+    unsigned int nodes = rnd.between(o.nodes_lo, o.nodes_hi);
+    return "--seed=" + to_string(o.seed * 1000003 + i) + " --nodes=" + to_string(nodes) +
+           " --pairs=" + to_string(rnd.between(1, nodes)) + " --degree=" + to_string(rnd.between(4, 14)) +
+           " --placement=" + placements[rnd.next() % 4] + " --traffic=" + traffic[rnd.next() % 3] +
+           " --clusters=" + to_string(rnd.between(2, 6)) + " --aspect=" + to_string(rnd.between(4, 32)) +
+           " --traffic-gap=" + to_string(rnd.between(0, 40));
+}
+
+// run ref and cand on scenario; false if their logs differ
+bool compare_run(const golden_options &o, const string &what, const string &scenario, const string &expected)
+{
+    string ref_out = o.work + "/golden_ref.out", cand_out = o.work + "/golden_cand.out", cand_in = scenario;
+    string cand = o.cand;
+    if (!o.record_with.empty())
+    {
+        string log = o.work + "/golden.replay";
+        if (run(o.record_with + " --record=" + log + " < " + scenario + " > /dev/null 2> /dev/null") != 0)
+        {
+            cout << "FAILED " << what << ": cannot record the scenario" << endl;
+            return false;
+        }
+        cand += " --replay=" + log;
+    }
+    if (o.cand_binary)
+    {
+        cand_in = o.work + "/golden.bin";
+        if (run(o.convert + " --adjacency " + scenario + " " + cand_in) != 0)
+        {
+            cout << "FAILED " << what << ": cannot convert the scenario" << endl;
+            return false;
+        }
+    }
+    int ref_status = run(o.ref + " < " + scenario + " > " + ref_out + " 2> /dev/null");
+    int cand_status = run(cand + " < " + cand_in + " > " + cand_out + " 2> /dev/null");
+    if (!o.record_with.empty() && cand_status == 3)
+        cand_status = 0; // the replay diverged from the record
+    // a crash or a watchdog abort may leave the same truncated log on both sides
+    if (ref_status != 0 || cand_status != 0)
+    {
+        cout << "FAILED " << what << ": exit status " << ref_status << " of " << o.ref << ", " << cand_status << " of "
+             << o.cand << endl;
+        return false;
+    }
+    vector<string> ref_log = read_lines(ref_out), cand_log = read_lines(cand_out);
+    if (!o.record_with.empty())
+    {
+        sort(ref_log.begin(), ref_log.end());
+        sort(cand_log.begin(), cand_log.end());
+    }
+    bool ok = true;
+    if (!expected.empty())
+    {
+        vector<string> golden = read_lines(expected);
+        if (!o.record_with.empty())
+            sort(golden.begin(), golden.end());
+        ok = same_log(what + " (reference)", expected, golden, o.ref, ref_log, o.context);
+        ok = same_log(what + " (candidate)", expected, golden, cand, cand_log, o.context) && ok;
+    }
+    else
+        ok = same_log(what, o.ref, ref_log, cand, cand_log, o.context);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    golden_options o;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i], value;
+        if (option_value(arg, "ref", o.ref) || option_value(arg, "cand", o.cand) || option_value(arg, "gen", o.gen) ||
+            option_value(arg, "convert", o.convert) || option_value(arg, "work", o.work) ||
+            option_value(arg, "record-with", o.record_with))
+            continue;
+        bool bad = false; // an unknown option or a number option with a wrong value
+        if (arg == "--cand-binary")
+            o.cand_binary = true;
+        else if (option_value(arg, "sample", value))
+            o.samples.push_back(value);
+        else if (option_value(arg, "nodes", value))
+        {
+            size_t colon = value.find(':');
+            bad = colon == string::npos || !parse_number(value.substr(0, colon), o.nodes_lo) ||
+                  !parse_number(value.substr(colon + 1), o.nodes_hi);
+        }
+        else if (!option_number(arg, "scenarios", o.scenarios, bad) && !option_number(arg, "seed", o.seed, bad) &&
+                 !option_number(arg, "context", o.context, bad) && !option_number(arg, "max-failures", o.max_failures, bad))
+            bad = true;
+        if (bad)
+        {
+            cerr << "usage: " << argv[0] << " [--ref=cmd] [--cand=cmd] [--cand-binary] [--record-with=cmd] [--sample=in]" << endl
+                 << "       [--scenarios=n] [--seed=s] [--nodes=lo:hi] [--context=n] [--max-failures=n] [--gen=path]" << endl
+                 << "       [--convert=path] [--work=dir]" << endl;
+            return 1;
+        }
+    }
+    if (o.nodes_lo < 2 || o.nodes_lo > o.nodes_hi)
+    {
+        cerr << "--nodes should be lo:hi with 2 <= lo <= hi" << endl;
+        return 1;
+    }
+
+    unsigned int failures = 0, passed = 0;
+    for (const string &sample : o.samples)
+    {
+        string expected = sample.substr(0, sample.rfind('.')) + ".out";
+        if (compare_run(o, sample, sample, expected))
+            passed++;
+        else
+            failures++;
+    }
+    string scenario = o.work + "/golden.in";
+    for (unsigned int i = 0; i < o.scenarios && failures < o.max_failures; i++)
+    {
+        string args = scenario_args(o, i);
+        if (run(o.gen + " " + args + " --out=" + scenario) != 0)
+        {
+            cout << "FAILED scenario " << i << ": " << o.gen << " " << args << endl;
+            failures++;
+            continue;
+        }
+        if (compare_run(o, "scenario " + to_string(i), scenario, ""))
+            passed++;
+        else
+        {
+            cout << "  regenerate with: " << o.gen << " " << args << endl;
+            failures++;
+        }
+    }
+    cout << passed << " passed, " << failures << " failed (" << o.cand << " against " << o.ref << ")" << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -9,6 +9,31 @@
 #include <stack>
 #include <cmath>
 #include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <charconv>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#endif
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h> // it declares a function named link, so the class is written as class link where it matters
+#include "trace_format.h"
+#include "scenario_format.h"
+#include "checkpoint_format.h"
+#include "option_format.h"
 
 using namespace std;
 
@@ -28,7 +53,83 @@ class link; // new
 // if you want to simulate the more details, you should revise it to be a class
 const unsigned int ONE_HOP_DELAY = 10;
 const unsigned int BROCAST_ID = UINT_MAX;
-unsigned int X_MAX, Y_MAX; //ccu 
+unsigned int X_MAX, Y_MAX; //ccu
+
+// the simulation time is a 64-bit fixed-point number of ticks with TIME_FRAC_BITS fractional bits:
+// it does not wrap around in long runs and keeps the fractional part of the link latencies.
+// the scenario gives whole ticks; the logs print whole ticks, or ticks with a fraction when there is one
+typedef unsigned long long sim_time;
+const unsigned int TIME_FRAC_BITS = 16;
+const sim_time TIME_ONE_TICK = (sim_time)1 << TIME_FRAC_BITS;
+const sim_time SIM_TIME_MAX = ULLONG_MAX;
+static_assert(TIME_FRAC_BITS == TRACE_TIME_FRAC_BITS, "the binary event log stores the simulation time as it is");
+
+inline sim_time ticks_to_time(unsigned long long ticks) { return ticks << TIME_FRAC_BITS; }
+inline sim_time latency_to_time(double latency) { return latency <= 0 ? 0 : (sim_time)llround(latency * TIME_ONE_TICK); }
+inline unsigned long long time_to_ticks(sim_time t) { return t >> TIME_FRAC_BITS; } // rounded down
+// "12" or "12.5": the shortest decimal fraction which reads back as the same time
+string time_to_string(sim_time t)
+{
+    string s = to_string(time_to_ticks(t));
+    sim_time frac = t & (TIME_ONE_TICK - 1);
+    if (frac != 0)
+    {
+        s += '.';
+        while (frac != 0) // every binary fraction of TIME_FRAC_BITS bits has a finite decimal expansion
+        {
+            frac *= 10;
+            s += (char)('0' + time_to_ticks(frac));
+            frac &= TIME_ONE_TICK - 1;
+        }
+    }
+    return s;
+}
+
+// runtime options; they are set by parse_options() in main()
+unsigned int REP_NUM = 1;   // each node id is hashed to REP_NUM home points
+bool LOOKUP_REPORT = false; // print the hop count of every location lookup
+bool PATH_CACHE = false;    // forwarding nodes cache the positions carried by Res_packet and Rep_packet
+bool MIX_HASH = false;      // myHash uses a splitmix64 mixer instead of hash<string>
+bool HOME_REPORT = false;   // print the number of location records stored by every home node
+bool PERIMETER = false;     // fall back to GPSR perimeter routing when greedy forwarding fails
+unsigned int TTL_MAX = 255; // a packet is dropped when it has travelled TTL_MAX hops
+bool TTL_GIVEN = false;     // TTL_MAX comes from --ttl; otherwise PERIMETER raises it with the node number
+bool HOP_STATS = false;     // print the hop histograms and the drop reasons of every packet type
+unsigned int LOOKUP_TIMEOUT = 0; // if not 0, a GR_packet waiting for a location lookup gives up after this many ticks
+unsigned int LOOKUP_RETRIES = 0; // the Ret_packet of a lookup which timed out is sent again up to this many times
+unsigned int HELLO_INTERVAL = 0; // if not 0, every node broadcasts a HELLO this often after its first one
+unsigned int HELLO_JITTER = 0;   // each interval between HELLOs is HELLO_INTERVAL plus or minus up to this much
+unsigned int NEIGHBOR_TIMEOUT = 0; // if not 0, a neighbor not heard from for this long is forgotten
+string TRACE_FILE = "";                // the event log is written to this file instead of stdout
+size_t TRACE_BUFFER = 1 << 22;         // the size of each buffer of the event log in bytes
+bool TRACE_BINARY = false;             // write the event log in the binary format of trace_format.h
+bool TRACE_ON = true;                  // with --trace=off, events are not formatted at all
+map<string, bool> TRACE_TYPES;         // only these packet types are logged; empty means all types
+unsigned int TRACE_SAMPLE = 1;         // only one of every TRACE_SAMPLE events passing TRACE_TYPES is logged
+string SCENARIO_FILE = "";             // the scenario is read from this file instead of stdin
+bool STREAM_TRAFFIC = false;           // the traffic pairs are injected while the simulation runs, not preloaded
+string SUMMARY = "";                   // "text" or "json": print the size, speed and memory of the run to stderr
+string STATS_FORMAT = "";              // "csv" or "json": dump the packet and event counters
+string STATS_FILE = "";                // the counters are dumped to this file instead of stderr
+unsigned int STATS_INTERVAL = 0;       // if not 0, the counters are also dumped every STATS_INTERVAL time units
+string PROFILE = "";                   // "table" or "folded": time the event loop (see class profiler)
+string PROFILE_FILE = "";              // the profile is written to this file instead of stderr
+unsigned int PROFILE_SAMPLE = 1;       // only one of every PROFILE_SAMPLE events is timed
+unsigned int PROFILE_DEPTH_STEP = 100; // the pending events are sampled per PROFILE_DEPTH_STEP time units
+double PROGRESS_INTERVAL = 0;          // if not 0, a progress line is printed to stderr every PROGRESS_INTERVAL wall seconds
+size_t MAX_EVENTS = 0;                 // if not 0, more pending events than this is a storm (see class watchdog)
+int MAX_PACKETS = 0;                   // if not 0, more live packets than this is a storm
+string STORM_POLICY = "abort";         // what the watchdog does in a storm: "drop", "delay" or "abort"
+map<string, bool> STORM_DROP = {{"HI_packet", true}, {"Rep_packet", true}}; // the packet types "drop" gives up first
+string CHECKPOINT_FILE = "";           // the state is saved to this file once the simulation passes CHECKPOINT_AT
+sim_time CHECKPOINT_AT = SIM_TIME_MAX; // SIM_TIME_MAX means no checkpoint
+string RESTORE_FILE = "";              // the state is restored from this file and only the traffic is read; the
+                                       // pairs the checkpointed run had already scheduled are skipped
+string RECORD_FILE = "";               // the order in which the events are triggered is written to this file
+string REPLAY_FILE = "";               // the events are triggered in the order recorded in this file
+unsigned int STORM_DELAY = 10;         // "delay" postpones the traffic pairs by this many time units at a time
+size_t FLIGHT_RECORDS = 0;             // if not 0, the last FLIGHT_RECORDS events are kept for a post-mortem dump
+string FLIGHT_FILE = "hw4.flight";     // the flight recorder is dumped here, in the binary format of trace_format.h
 
 // BROCAST_ID means that all neighbors are receivers; UINT_MAX is the maximum value of unsigned int
 
@@ -45,9 +146,41 @@ public:
     GET(getDstID, unsigned int, dstID);
     GET(getPreID, unsigned int, preID);
     GET(getNexID, unsigned int, nexID);
+    SET(setHopNum, unsigned int, hopNum, _hopNum);
+    GET(getHopNum, unsigned int, hopNum);
+    SET(setTTL, unsigned int, ttl, _ttl);
+    GET(getTTL, unsigned int, ttl);
+
+    // the state of GPSR perimeter mode; see GR_node::next_hop()
+    SET(setPeriMode, bool, periMode, _periMode);
+    GET(getPeriMode, bool, periMode);
+    SET(setLpX, double, lpX, _lpX);
+    GET(getLpX, double, lpX);
+    SET(setLpY, double, lpY, _lpY);
+    GET(getLpY, double, lpY);
+    SET(setLfX, double, lfX, _lfX);
+    GET(getLfX, double, lfX);
+    SET(setLfY, double, lfY, _lfY);
+    GET(getLfY, double, lfY);
+    SET(setE0From, unsigned int, e0From, _e0From);
+    GET(getE0From, unsigned int, e0From);
+    SET(setE0To, unsigned int, e0To, _e0To);
+    GET(getE0To, unsigned int, e0To);
 
     virtual string type() = 0;
 
+    // the fields for a checkpoint; a derived header writes and reads its own fields after these
+    virtual void save(checkpoint_out &out) const
+    {
+        out.put(srcID), out.put(dstID), out.put(preID), out.put(nexID), out.put(hopNum), out.put(ttl);
+        out.put(periMode), out.put(lpX), out.put(lpY), out.put(lfX), out.put(lfY), out.put(e0From), out.put(e0To);
+    }
+    virtual void load(checkpoint_in &in)
+    {
+        in.get(srcID), in.get(dstID), in.get(preID), in.get(nexID), in.get(hopNum), in.get(ttl);
+        in.get(periMode), in.get(lpX), in.get(lpY), in.get(lfX), in.get(lfY), in.get(e0From), in.get(e0To);
+    }
+
     // factory concept: generate a header
     class header_generator
     {
@@ -87,13 +220,21 @@ public:
     };
 
 protected:
-    header() : srcID(BROCAST_ID), dstID(BROCAST_ID), preID(BROCAST_ID), nexID(BROCAST_ID) {} // this constructor cannot be directly called by users
+    header() : srcID(BROCAST_ID), dstID(BROCAST_ID), preID(BROCAST_ID), nexID(BROCAST_ID), hopNum(0), ttl(TTL_MAX),
+               periMode(false), lpX(0), lpY(0), lfX(0), lfY(0), e0From(BROCAST_ID), e0To(BROCAST_ID) {} // this constructor cannot be directly called by users
 
 private:
     unsigned int srcID;
     unsigned int dstID;
     unsigned int preID;
     unsigned int nexID;
+    unsigned int hopNum; // the number of links the packet has travelled
+    unsigned int ttl;    // the packet is dropped instead of travelling more than ttl links
+    bool periMode;      // the packet is in perimeter mode
+    double lpX, lpY;    // the position where the packet entered perimeter mode
+    double lfX, lfY;    // the position where the packet entered the current face
+    unsigned int e0From; // the first edge traversed on the current face
+    unsigned int e0To;
     header(header &) {} // this constructor cannot be directly called by users
 };
 map<string, header::header_generator *> header::header_generator::prototypes;
@@ -104,11 +245,12 @@ class GR_header : public header
     double dstY;
     double srcX; // the position of the source
     double srcY;
+    sim_time startTime; // when the source sent the packet, for the end-to-end latency
 
     GR_header(GR_header &) {} // cannot be called by users
 
 protected:
-    GR_header() : dstX(0), dstY(0) {} // this constructor cannot be directly called by users
+    GR_header() : dstX(0), dstY(0), startTime(0) {} // this constructor cannot be directly called by users
 
 public:
     ~GR_header() {}
@@ -121,8 +263,20 @@ public:
     GET(getSrcX, double, srcX);
     SET(setSrcY, double, srcY, _srcY);
     GET(getSrcY, double, srcY);
+    SET(setStartTime, sim_time, startTime, _startTime);
+    GET(getStartTime, sim_time, startTime);
 
     string type() { return "GR_header"; }
+    void save(checkpoint_out &out) const
+    {
+        header::save(out);
+        out.put(dstX), out.put(dstY), out.put(srcX), out.put(srcY), out.put(startTime);
+    }
+    void load(checkpoint_in &in)
+    {
+        header::load(in);
+        in.get(dstX), in.get(dstY), in.get(srcX), in.get(srcY), in.get(startTime);
+    }
 
     class GR_header_generator;
     friend class GR_header_generator;
@@ -160,7 +314,7 @@ class HI_header : public header //ccu
     HI_header(HI_header &) {} // cannot be called by users
 
 protected:
-    HI_header() : dstX(0), dstY(0) {} // this constructor cannot be directly called by users
+    HI_header() : dstX(0), dstY(0), srcX(0), srcY(0) {} // this constructor cannot be directly called by users
 
 public:
     ~HI_header() {}
@@ -175,6 +329,16 @@ public:
     GET(getSrcY, double, srcY);
 
     string type() { return "HI_header"; }
+    void save(checkpoint_out &out) const
+    {
+        header::save(out);
+        out.put(dstX), out.put(dstY), out.put(srcX), out.put(srcY);
+    }
+    void load(checkpoint_in &in)
+    {
+        header::load(in);
+        in.get(dstX), in.get(dstY), in.get(srcX), in.get(srcY);
+    }
 
     class HI_header_generator;
     friend class HI_header_generator;
@@ -228,6 +392,16 @@ public:
 
 
     string type() { return "Rep_header"; }
+    void save(checkpoint_out &out) const
+    {
+        header::save(out);
+        out.put(dstX), out.put(dstY), out.put(srcX), out.put(srcY);
+    }
+    void load(checkpoint_in &in)
+    {
+        header::load(in);
+        in.get(dstX), in.get(dstY), in.get(srcX), in.get(srcY);
+    }
 
     class Rep_header_generator;
     friend class Rep_header_generator;
@@ -283,6 +457,16 @@ public:
     GET(getcacheID, unsigned int, cacheID);
 
     string type() { return "Ret_header"; }
+    void save(checkpoint_out &out) const
+    {
+        header::save(out);
+        out.put(dstX), out.put(dstY), out.put(srcX), out.put(srcY), out.put(cacheID);
+    }
+    void load(checkpoint_in &in)
+    {
+        header::load(in);
+        in.get(dstX), in.get(dstY), in.get(srcX), in.get(srcY), in.get(cacheID);
+    }
 
     class Ret_header_generator;
     friend class Ret_header_generator;
@@ -317,11 +501,12 @@ class Res_header : public header //ccu
     double srcX; // the position of the source
     double srcY;
     unsigned int cacheID;
+    unsigned int retHopNum; // the number of hops of the Ret_packet answered by this response
 
     Res_header(Res_header &) {} // cannot be called by users
 
 protected:
-    Res_header() : dstX(0), dstY(0) {} // this constructor cannot be directly called by users
+    Res_header() : dstX(0), dstY(0), retHopNum(0) {} // this constructor cannot be directly called by users
 
 public:
     ~Res_header() {}
@@ -336,8 +521,20 @@ public:
     GET(getSrcY, double, srcY);
     SET(setcacheID, unsigned int, cacheID, _cacheID);
     GET(getcacheID, unsigned int, cacheID);
+    SET(setretHopNum, unsigned int, retHopNum, _retHopNum);
+    GET(getretHopNum, unsigned int, retHopNum);
 
     string type() { return "Res_header"; }
+    void save(checkpoint_out &out) const
+    {
+        header::save(out);
+        out.put(dstX), out.put(dstY), out.put(srcX), out.put(srcY), out.put(cacheID), out.put(retHopNum);
+    }
+    void load(checkpoint_in &in)
+    {
+        header::load(in);
+        in.get(dstX), in.get(dstY), in.get(srcX), in.get(srcY), in.get(cacheID), in.get(retHopNum);
+    }
 
     class Res_header_generator;
     friend class Res_header_generator;
@@ -374,6 +571,9 @@ protected:
 public:
     virtual ~payload() {}
     virtual string type() = 0;
+    // the fields for a checkpoint
+    virtual void save(checkpoint_out &out) const = 0;
+    virtual void load(checkpoint_in &in) = 0;
 
     class payload_generator
     {
@@ -429,6 +629,8 @@ public:
     GET(getMsg, string, msg);
 
     string type() { return "GR_payload"; }
+    void save(checkpoint_out &out) const { out.put(msg); }
+    void load(checkpoint_in &in) { in.get(msg); }
 
     class GR_payload_generator;
     friend class GR_payload_generator;
@@ -471,6 +673,8 @@ public:
     GET(getMsg, string, msg);
 
     string type() { return "HI_payload"; }
+    void save(checkpoint_out &out) const { out.put(msg); }
+    void load(checkpoint_in &in) { in.get(msg); }
 
     class HI_payload_generator;
     friend class HI_payload_generator;
@@ -513,6 +717,8 @@ public:
     GET(getMsg, string, msg);
 
     string type() { return "Rep_payload"; }
+    void save(checkpoint_out &out) const { out.put(msg); }
+    void load(checkpoint_in &in) { in.get(msg); }
 
     class Rep_payload_generator;
     friend class Rep_payload_generator;
@@ -555,6 +761,8 @@ public:
     GET(getMsg, string, msg);
 
     string type() { return "Ret_payload"; }
+    void save(checkpoint_out &out) const { out.put(msg); }
+    void load(checkpoint_in &in) { in.get(msg); }
 
     class Ret_payload_generator;
     friend class Ret_payload_generator;
@@ -597,6 +805,8 @@ public:
     GET(getMsg, string, msg);
 
     string type() { return "Res_payload"; }
+    void save(checkpoint_out &out) const { out.put(msg); }
+    void load(checkpoint_in &in) { in.get(msg); }
 
     class Res_payload_generator;
     friend class Res_payload_generator;
@@ -624,28 +834,260 @@ public:
 };
 Res_payload::Res_payload_generator Res_payload::Res_payload_generator::sample;
 
+// the event loop profiler of --profile; time is read from the cycle counter and every profile_scope
+// adds its own time (without the time of the scopes inside it) to the stack of names leading to it
+class profiler
+{
+    // the stack of the scopes being timed
+    class frame
+    {
+    public:
+        const char *name;
+        unsigned long long begin;
+        unsigned long long children; // the cycles spent in the scopes inside this one
+    };
+    class path_time
+    {
+    public:
+        unsigned long long calls;
+        unsigned long long cycles;
+        path_time() : calls(0), cycles(0) {}
+    };
+    static vector<frame> stack;
+    static map<vector<const char *>, path_time> paths;
+    static map<string, const char *> names; // the names which are not string literals, e.g. packet types
+    class trigger_time
+    {
+    public:
+        unsigned long long calls;
+        unsigned long long cycles;
+        vector<unsigned long long> hist; // the number of calls taking [2^k, 2^(k+1)) cycles
+        trigger_time() : calls(0), cycles(0) {}
+    };
+    static map<pair<const char *, const char *>, trigger_time> triggers; // by (event type, packet type)
+    static map<unsigned long long, size_t> depth; // ticks / PROFILE_DEPTH_STEP -> the largest number of pending events
+    static unsigned long long events, sampled;
+    static unsigned long long tsc_begin;
+    static chrono::steady_clock::time_point clock_begin;
+
+    static unsigned long long cycles()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+    static double ns_per_cycle();
+
+public:
+    static bool active; // the current event is sampled
+
+    static const char *intern(const string &name)
+    {
+        map<string, const char *>::iterator it = names.find(name);
+        if (it == names.end())
+            it = names.insert(make_pair(name, strdup(name.c_str()))).first;
+        return it->second;
+    }
+    static void enter(const char *name)
+    {
+        frame f = {name, cycles(), 0};
+        stack.push_back(f);
+    }
+    static unsigned long long leave()
+    {
+        unsigned long long total = cycles() - stack.back().begin;
+        vector<const char *> path(stack.size());
+        for (size_t i = 0; i < stack.size(); i++)
+            path[i] = stack[i].name;
+        path_time &t = paths[path];
+        t.calls++;
+        t.cycles += total - stack.back().children;
+        stack.pop_back();
+        if (!stack.empty())
+            stack.back().children += total;
+        return total;
+    }
+
+    // decide whether the next event is timed; the first event also starts the clock
+    static void next_event(sim_time time, size_t pending)
+    {
+        if (events == 0)
+        {
+            tsc_begin = cycles();
+            clock_begin = chrono::steady_clock::now();
+        }
+        active = (events++ % PROFILE_SAMPLE == 0);
+        if (!active)
+            return;
+        sampled++;
+        size_t &d = depth[time_to_ticks(time) / PROFILE_DEPTH_STEP];
+        if (pending > d)
+            d = pending;
+    }
+    static void enter_trigger(const string &event_type, const string &packet_type)
+    {
+        enter("trigger");
+        enter(intern(event_type));
+        enter(intern(packet_type));
+    }
+    static void leave_trigger()
+    {
+        const char *packet_type = stack.back().name;
+        unsigned long long total = leave();
+        const char *event_type = stack.back().name;
+        leave();
+        leave();
+        trigger_time &t = triggers[make_pair(event_type, packet_type)];
+        t.calls++;
+        t.cycles += total;
+        unsigned int bucket = 0;
+        while (bucket < 63 && (total >> (bucket + 1)) != 0)
+            bucket++;
+        if (t.hist.size() <= bucket)
+            t.hist.resize(bucket + 1);
+        t.hist[bucket]++;
+    }
+    static void print();
+};
+vector<profiler::frame> profiler::stack;
+map<vector<const char *>, profiler::path_time> profiler::paths;
+map<string, const char *> profiler::names;
+map<pair<const char *, const char *>, profiler::trigger_time> profiler::triggers;
+map<unsigned long long, size_t> profiler::depth;
+unsigned long long profiler::events = 0;
+unsigned long long profiler::sampled = 0;
+unsigned long long profiler::tsc_begin = 0;
+chrono::steady_clock::time_point profiler::clock_begin;
+bool profiler::active = false;
+
+// time the rest of the block if the current event is sampled
+class profile_scope
+{
+    bool on;
+
+public:
+    profile_scope(const char *name) : on(profiler::active)
+    {
+        if (on)
+            profiler::enter(name);
+    }
+    ~profile_scope()
+    {
+        if (on)
+            profiler::leave();
+    }
+};
+
+double profiler::ns_per_cycle()
+{
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - clock_begin).count();
+    unsigned long long c = cycles() - tsc_begin;
+    return c == 0 ? 1 : ns / c;
+}
+
+void profiler::print()
+{
+    if (PROFILE.empty() || events == 0)
+        return;
+    ofstream file;
+    if (!PROFILE_FILE.empty())
+        file.open(PROFILE_FILE);
+    ostream &out = file.is_open() ? file : cerr;
+    double scale = ns_per_cycle();
+    if (PROFILE == "folded")
+    {
+        // one line per stack with its own time in ns, e.g. for flamegraph.pl
+        for (map<vector<const char *>, path_time>::iterator it = paths.begin(); it != paths.end(); it++)
+        {
+            for (size_t i = 0; i < it->first.size(); i++)
+                out << (i == 0 ? "event_loop;" : ";") << it->first[i];
+            out << " " << (unsigned long long)(it->second.cycles * scale) << "\n";
+        }
+        return;
+    }
+
+    unsigned long long total = 0;
+    for (map<vector<const char *>, path_time>::iterator it = paths.begin(); it != paths.end(); it++)
+        total += it->second.cycles;
+    vector<pair<unsigned long long, string>> rows;
+    for (map<vector<const char *>, path_time>::iterator it = paths.begin(); it != paths.end(); it++)
+    {
+        ostringstream row;
+        string path;
+        for (size_t i = 0; i < it->first.size(); i++)
+            path += (i == 0 ? "" : ";") + string(it->first[i]);
+        row << setw(66) << left << path << right << setw(12) << it->second.calls << setw(12) << fixed << setprecision(3)
+            << it->second.cycles * scale / 1e6 << setw(8) << setprecision(1) << 100. * it->second.cycles / total;
+        rows.push_back(make_pair(it->second.cycles, row.str()));
+    }
+    sort(rows.rbegin(), rows.rend());
+    out << "profile: " << sampled << " of " << events << " events timed, " << setprecision(3) << 1 / scale
+        << " cycles per ns" << endl;
+    out << setw(66) << left << "scope (self time)" << right << setw(12) << "calls" << setw(12) << "ms" << setw(8) << "%" << endl;
+    for (size_t i = 0; i < rows.size(); i++)
+        out << rows[i].second << endl;
+
+    // the buckets are powers of two, so the percentiles are upper bounds
+    out << endl << setw(30) << left << "trigger()" << right << setw(12) << "calls" << setw(12) << "mean us" << setw(12)
+        << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << endl;
+    for (map<pair<const char *, const char *>, trigger_time>::iterator it = triggers.begin(); it != triggers.end(); it++)
+    {
+        const vector<unsigned long long> &hist = it->second.hist;
+        unsigned long long calls = it->second.calls, seen = 0;
+        double p50 = 0, p99 = 0;
+        for (size_t b = 0; b < hist.size(); b++)
+        {
+            seen += hist[b];
+            if (p50 == 0 && seen * 2 >= calls)
+                p50 = (2ULL << b) * scale / 1e3;
+            if (p99 == 0 && seen * 100 >= calls * 99)
+                p99 = (2ULL << b) * scale / 1e3;
+        }
+        out << setw(30) << left << (string(it->first.first) + " " + it->first.second) << right << setw(12) << calls
+            << setw(12) << fixed << setprecision(2) << it->second.cycles * scale / 1e3 / calls << setw(12) << p50 << setw(12) << p99
+            << setw(12) << (2ULL << (hist.size() - 1)) * scale / 1e3 << endl;
+    }
+
+    out << endl << "pending events (largest per " << PROFILE_DEPTH_STEP << " time units):";
+    for (map<unsigned long long, size_t>::iterator it = depth.begin(); it != depth.end(); it++)
+        out << " " << it->first * PROFILE_DEPTH_STEP << ":" << it->second;
+    out << endl;
+}
+
 class packet
 {
     // a packet usually contains a header and a payload
     header *hdr;
     payload *pld;
     unsigned int p_id;
+    unsigned int type_index; // the index of its packet_generator, set by the generator
     static unsigned int last_packet_id;
+    static unsigned int pinned_id; // if not UINT_MAX, the id of the next new packet (see reservePacketIDs)
+    static unsigned int next_packet_id()
+    {
+        if (pinned_id == UINT_MAX)
+            return last_packet_id++;
+        unsigned int id = pinned_id;
+        pinned_id = UINT_MAX;
+        return id;
+    }
 
     packet(packet &) {}
     static int live_packet_num;
 
 protected:
     // these constructors cannot be directly called by users
-    packet() : hdr(nullptr), pld(nullptr)
+    packet() : hdr(nullptr), pld(nullptr), type_index(0)
     {
-        p_id = last_packet_id++;
+        p_id = next_packet_id();
         live_packet_num++;
     }
-    packet(string _hdr, string _pld, bool rep = false, unsigned int rep_id = 0)
+    packet(string _hdr, string _pld, bool rep = false, unsigned int rep_id = 0) : type_index(0)
     {
         if (!rep) // a duplicated packet does not have a new packet id
-            p_id = last_packet_id++;
+            p_id = next_packet_id();
         else
             p_id = rep_id;
         hdr = header::header_generator::generate(_hdr);
@@ -670,6 +1112,17 @@ public:
     SET(setPayload, payload *, pld, _pld);
     GET(getPayload, payload *, pld);
     GET(getPacketID, unsigned int, p_id);
+    GET(getTypeIndex, unsigned int, type_index); // a small number per packet type, for the counters
+
+    // skip num packet ids and return the first one; a skipped id is given to a packet later by pinPacketID,
+    // so packets created out of order still get the ids they would have had
+    static unsigned int reservePacketIDs(unsigned int num)
+    {
+        unsigned int first = last_packet_id;
+        last_packet_id += num;
+        return first;
+    }
+    static void pinPacketID(unsigned int id) { pinned_id = id; }
 
     static void discard(packet *&p)
     {
@@ -688,6 +1141,12 @@ public:
 
     static int getLivePacketNum() { return live_packet_num; }
 
+    // write p (or a null packet) for a checkpoint; load() creates it again with the same id
+    static void save(checkpoint_out &out, packet *p);
+    static packet *load(checkpoint_in &in);
+    static void saveIDs(checkpoint_out &out) { out.put(last_packet_id); }
+    static void loadIDs(checkpoint_in &in) { in.get(last_packet_id); }
+
     class packet_generator;
     friend class packet_generator;
     class packet_generator
@@ -696,12 +1155,19 @@ public:
         packet_generator(packet_generator &) {}
         // store all possible types of packet
         static map<string, packet_generator *> prototypes;
+        static vector<packet_generator *> by_index; // the generators in the order they were registered
+        unsigned int index;                          // the position of this generator in by_index
 
     protected:
         // allow derived class to use it
-        packet_generator() {}
+        packet_generator() : index(0) {}
         // after you create a new packet type, please register the factory of this payload type by this function
-        void register_packet_type(packet_generator *h) { prototypes[h->type()] = h; }
+        void register_packet_type(packet_generator *h)
+        {
+            h->index = by_index.size();
+            by_index.push_back(h);
+            prototypes[h->type()] = h;
+        }
         // you have to implement your own generate() to generate your payload
         virtual packet *generate(packet *p = nullptr) = 0;
 
@@ -711,21 +1177,24 @@ public:
         // this function is used to generate any type of packet derived
         static packet *generate(string type)
         {
-            if (prototypes.find(type) != prototypes.end())
-            {                                        // if this type derived exists
-                return prototypes[type]->generate(); // generate it!!
+            map<string, packet_generator *>::iterator it = prototypes.find(type);
+            if (it != prototypes.end())
+            { // if this type derived exists
+                packet *p = it->second->generate(); // generate it!!
+                p->type_index = it->second->index;
+                return p;
             }
             std::cerr << "no such packet type" << std::endl; // otherwise
             return nullptr;
         }
+        static bool known(const string &type) { return prototypes.find(type) != prototypes.end(); }
         static packet *replicate(packet *p)
         {
-            if (prototypes.find(p->type()) != prototypes.end())
-            {                                              // if this type derived exists
-                return prototypes[p->type()]->generate(p); // generate it!!
-            }
-            std::cerr << "no such packet type" << std::endl; // otherwise
-            return nullptr;
+            profile_scope scope("replicate");
+            packet_generator *g = by_index[p->type_index]; // p came from a generator, so its type exists
+            packet *copy = g->generate(p);
+            copy->type_index = g->index;
+            return copy;
         }
         static void print()
         {
@@ -737,9 +1206,44 @@ public:
     };
 };
 map<string, packet::packet_generator *> packet::packet_generator::prototypes;
+vector<packet::packet_generator *> packet::packet_generator::by_index;
 unsigned int packet::last_packet_id = 0;
+unsigned int packet::pinned_id = UINT_MAX;
 int packet::live_packet_num = 0;
 
+void packet::save(checkpoint_out &out, packet *p)
+{
+    if (p == nullptr)
+    {
+        out.put(string());
+        return;
+    }
+    out.put(p->type());
+    out.put(p->p_id);
+    p->hdr->save(out);
+    p->pld->save(out);
+}
+packet *packet::load(checkpoint_in &in)
+{
+    string type;
+    unsigned int id = 0;
+    in.get(type);
+    if (type.empty() || in.failed())
+        return nullptr;
+    in.get(id);
+    pinPacketID(id);
+    packet *p = packet_generator::generate(type);
+    pinPacketID(UINT_MAX);
+    if (p == nullptr)
+    {
+        in.fail();
+        return nullptr;
+    }
+    p->hdr->load(in);
+    p->pld->load(in);
+    return p;
+}
+
 // this packet is used to tell the destination the msg
 class GR_packet : public packet
 {
@@ -981,6 +1485,290 @@ public:
 };
 Res_packet::Res_packet_generator Res_packet::Res_packet_generator::sample;
 
+// the statistics of the whole simulation
+class sim_stats
+{
+public:
+    // what happened to the packets of one type or at one node
+    class counters
+    {
+    public:
+        unsigned long long sent;      // transmissions by node::send; a broadcast counts once
+        unsigned long long received;  // packets handed to node::recv
+        unsigned long long forwarded; // packets sent on by a node which is not their source
+        unsigned long long delivered; // packets consumed by the node they were meant for
+        unsigned long long dropped;
+        counters() : sent(0), received(0), forwarded(0), delivered(0), dropped(0) {}
+        bool empty() const { return sent == 0 && received == 0 && forwarded == 0 && delivered == 0 && dropped == 0; }
+    };
+
+private:
+    // packet type -> hop count -> the number of packets delivered with that many hops
+    static map<string, map<unsigned int, unsigned int>> hop_hist;
+    // packet type -> drop reason -> the number of packets dropped
+    static map<string, map<string, unsigned int>> drops;
+
+    // the types in the order they were first seen
+    static vector<string> type_names;
+    static vector<counters> type_counters;
+    static vector<counters> node_counters; // indexed by node id
+    static vector<string> event_names;
+    static vector<unsigned long long> event_counts;
+    // the type index of a packet or event -> its position in the vectors above, or NO_SLOT before the
+    // type is seen; only a type seen for the first time is looked up by name
+    static vector<size_t> type_slots, event_slots;
+    static const size_t NO_SLOT = SIZE_MAX;
+    static vector<map<unsigned int, unsigned int> *> hop_slots; // packet type index -> its entry of hop_hist
+    // the end-to-end latency as a sim_time, with its fraction of a tick, and the hop count of the
+    // delivered GR_packets: value -> packets
+    static map<unsigned long long, unsigned long long> gr_latency;
+    static map<unsigned long long, unsigned long long> gr_hops;
+    static ostream *stats_out;
+    static ofstream stats_file; // --stats-file
+    static sim_time next_dump;
+
+    // the position of name in names; a new name is added with a zero value
+    template <class T>
+    static size_t slot_of(const string &name, vector<string> &names, vector<T> &values)
+    {
+        size_t i = 0;
+        while (i < names.size() && names[i] != name)
+            i++;
+        if (i == names.size())
+        {
+            names.push_back(name);
+            values.push_back(T());
+        }
+        return i;
+    }
+    static counters &of_type(packet *p)
+    {
+        unsigned int t = p->getTypeIndex();
+        if (t >= type_slots.size())
+            type_slots.resize(t + 1, NO_SLOT);
+        if (type_slots[t] == NO_SLOT)
+            type_slots[t] = slot_of(p->type(), type_names, type_counters);
+        return type_counters[type_slots[t]];
+    }
+    static counters &of_node(unsigned int id)
+    {
+        if (id >= node_counters.size())
+            node_counters.resize(id + 1);
+        return node_counters[id];
+    }
+    static void dump_csv(sim_time time);
+    static void dump_json(sim_time time);
+
+public:
+    // the packet p has reached the node which consumes it
+    static void record_delivery(packet *p, unsigned int nodeID);
+    // the packet p cannot go further: "local minimum", "TTL", "missing node", "no link", "no record" or "storm"
+    static void record_drop(packet *p, string reason, unsigned int nodeID)
+    {
+        drops[p->type()][reason]++;
+        of_type(p).dropped++;
+        if (nodeID != BROCAST_ID)
+            of_node(nodeID).dropped++;
+    }
+    static void record_send(packet *p, unsigned int nodeID)
+    {
+        of_type(p).sent++;
+        of_node(nodeID).sent++;
+    }
+    static void record_recv(packet *p, unsigned int nodeID)
+    {
+        of_type(p).received++;
+        of_node(nodeID).received++;
+    }
+    static void record_forward(packet *p, unsigned int nodeID)
+    {
+        of_type(p).forwarded++;
+        of_node(nodeID).forwarded++;
+    }
+    static void record_event(const event *e);
+    static void print();
+    // the k nodes which sent the most packets, for the watchdog
+    static void print_top_talkers(ostream &out, size_t k);
+    // all the counters, for a checkpoint
+    static void saveState(checkpoint_out &out)
+    {
+        out.put(hop_hist), out.put(drops), out.put(type_names), out.put(type_counters), out.put(node_counters);
+        out.put(event_names), out.put(event_counts), out.put(gr_latency), out.put(gr_hops), out.put(next_dump);
+    }
+    static void loadState(checkpoint_in &in)
+    {
+        in.get(hop_hist), in.get(drops), in.get(type_names), in.get(type_counters), in.get(node_counters);
+        in.get(event_names), in.get(event_counts), in.get(gr_latency), in.get(gr_hops), in.get(next_dump);
+        type_slots.clear();
+        event_slots.clear();
+        hop_slots.clear();
+    }
+
+    // dump the counters (see --stats) at the interval boundaries up to time and, if final, at time itself
+    static void dump(sim_time time, bool final);
+};
+map<string, map<unsigned int, unsigned int>> sim_stats::hop_hist;
+map<string, map<string, unsigned int>> sim_stats::drops;
+vector<string> sim_stats::type_names;
+vector<sim_stats::counters> sim_stats::type_counters;
+vector<sim_stats::counters> sim_stats::node_counters;
+vector<string> sim_stats::event_names;
+vector<unsigned long long> sim_stats::event_counts;
+const size_t sim_stats::NO_SLOT;
+vector<size_t> sim_stats::type_slots;
+vector<size_t> sim_stats::event_slots;
+vector<map<unsigned int, unsigned int> *> sim_stats::hop_slots;
+map<unsigned long long, unsigned long long> sim_stats::gr_latency;
+map<unsigned long long, unsigned long long> sim_stats::gr_hops;
+ostream *sim_stats::stats_out = nullptr;
+ofstream sim_stats::stats_file;
+sim_time sim_stats::next_dump = 0;
+
+void sim_stats::dump(sim_time time, bool final)
+{
+    if (STATS_FORMAT.empty())
+        return;
+    if (stats_out == nullptr)
+    {
+        stats_out = &cerr;
+        if (!STATS_FILE.empty())
+        {
+            stats_file.open(STATS_FILE);
+            if (stats_file)
+                stats_out = &stats_file;
+            else
+                cerr << "cannot create " << STATS_FILE << "; the counters are written to stderr" << endl;
+        }
+        if (STATS_FORMAT == "csv")
+            *stats_out << "time,scope,key,counter,value" << endl;
+        next_dump = ticks_to_time(STATS_INTERVAL);
+    }
+    while (STATS_INTERVAL != 0 && next_dump <= time && (!final || next_dump < time))
+    {
+        if (STATS_FORMAT == "csv")
+            dump_csv(next_dump);
+        else
+            dump_json(next_dump);
+        next_dump += ticks_to_time(STATS_INTERVAL);
+    }
+    if (final)
+    {
+        if (STATS_FORMAT == "csv")
+            dump_csv(time);
+        else
+            dump_json(time);
+        stats_out->flush();
+    }
+}
+
+void sim_stats::dump_csv(sim_time time)
+{
+    ostream &out = *stats_out;
+    string t = time_to_string(time);
+    const char *names[] = {"sent", "received", "forwarded", "delivered", "dropped"};
+    for (size_t i = 0; i < type_names.size(); i++)
+    {
+        const counters &c = type_counters[i];
+        unsigned long long values[] = {c.sent, c.received, c.forwarded, c.delivered, c.dropped};
+        for (int k = 0; k < 5; k++)
+            out << t << ",type," << type_names[i] << "," << names[k] << "," << values[k] << "\n";
+    }
+    for (size_t id = 0; id < node_counters.size(); id++)
+    {
+        const counters &c = node_counters[id];
+        if (c.empty())
+            continue;
+        unsigned long long values[] = {c.sent, c.received, c.forwarded, c.delivered, c.dropped};
+        for (int k = 0; k < 5; k++)
+            out << t << ",node," << id << "," << names[k] << "," << values[k] << "\n";
+    }
+    for (size_t i = 0; i < event_names.size(); i++)
+        out << t << ",event," << event_names[i] << ",triggered," << event_counts[i] << "\n";
+    for (map<unsigned long long, unsigned long long>::iterator it = gr_latency.begin(); it != gr_latency.end(); it++)
+        out << t << ",latency,GR_packet," << time_to_string(it->first) << "," << it->second << "\n";
+    for (map<unsigned long long, unsigned long long>::iterator it = gr_hops.begin(); it != gr_hops.end(); it++)
+        out << t << ",hops,GR_packet," << it->first << "," << it->second << "\n";
+}
+
+void sim_stats::dump_json(sim_time time)
+{
+    ostream &out = *stats_out;
+    out << "{\"time\": " << time_to_string(time) << ", \"types\": {";
+    for (size_t i = 0; i < type_names.size(); i++)
+    {
+        const counters &c = type_counters[i];
+        out << (i == 0 ? "" : ", ") << "\"" << type_names[i] << "\": {\"sent\": " << c.sent << ", \"received\": " << c.received
+            << ", \"forwarded\": " << c.forwarded << ", \"delivered\": " << c.delivered << ", \"dropped\": " << c.dropped << "}";
+    }
+    out << "}, \"nodes\": [";
+    bool first = true;
+    for (size_t id = 0; id < node_counters.size(); id++)
+    {
+        const counters &c = node_counters[id];
+        if (c.empty())
+            continue;
+        out << (first ? "" : ", ") << "{\"id\": " << id << ", \"sent\": " << c.sent << ", \"received\": " << c.received
+            << ", \"forwarded\": " << c.forwarded << ", \"delivered\": " << c.delivered << ", \"dropped\": " << c.dropped << "}";
+        first = false;
+    }
+    out << "], \"events\": {";
+    for (size_t i = 0; i < event_names.size(); i++)
+        out << (i == 0 ? "" : ", ") << "\"" << event_names[i] << "\": " << event_counts[i];
+    map<unsigned long long, unsigned long long> *hists[] = {&gr_latency, &gr_hops};
+    const char *hist_names[] = {"gr_latency", "gr_hops"};
+    out << "}";
+    for (int h = 0; h < 2; h++)
+    {
+        // the latencies are sim_times, printed in ticks
+        auto value = [h](unsigned long long v) { return h == 0 ? time_to_string(v) : to_string(v); };
+        unsigned long long count = 0;
+        double sum = 0;
+        for (map<unsigned long long, unsigned long long>::iterator it = hists[h]->begin(); it != hists[h]->end(); it++)
+        {
+            count += it->second;
+            sum += (double)it->first * it->second;
+        }
+        out << ", \"" << hist_names[h] << "\": {\"count\": " << count;
+        if (count != 0)
+            out << ", \"mean\": " << sum / count / (h == 0 ? TIME_ONE_TICK : 1) << ", \"min\": " << value(hists[h]->begin()->first)
+                << ", \"max\": " << value(hists[h]->rbegin()->first);
+        out << ", \"hist\": {";
+        for (map<unsigned long long, unsigned long long>::iterator it = hists[h]->begin(); it != hists[h]->end(); it++)
+            out << (it == hists[h]->begin() ? "" : ", ") << "\"" << value(it->first) << "\": " << it->second;
+        out << "}}";
+    }
+    out << "}\n";
+}
+
+void sim_stats::print_top_talkers(ostream &out, size_t k)
+{
+    vector<pair<unsigned long long, unsigned int>> talkers; // (sent, node id)
+    for (size_t id = 0; id < node_counters.size(); id++)
+        if (node_counters[id].sent != 0)
+            talkers.push_back(make_pair(node_counters[id].sent, (unsigned int)id));
+    sort(talkers.rbegin(), talkers.rend());
+    out << "top talkers (node: sent received forwarded dropped):" << endl;
+    for (size_t i = 0; i < talkers.size() && i < k; i++)
+    {
+        const counters &c = node_counters[talkers[i].second];
+        out << "  " << talkers[i].second << ": " << c.sent << " " << c.received << " " << c.forwarded << " " << c.dropped << endl;
+    }
+}
+
+void sim_stats::print()
+{
+    for (map<string, map<unsigned int, unsigned int>>::iterator it = hop_hist.begin(); it != hop_hist.end(); it++)
+    {
+        cerr << "hops " << it->first << ":";
+        for (map<unsigned int, unsigned int>::iterator h = it->second.begin(); h != it->second.end(); h++)
+            cerr << " " << h->first << "x" << h->second;
+        cerr << endl;
+    }
+    for (map<string, map<string, unsigned int>>::iterator it = drops.begin(); it != drops.end(); it++)
+        for (map<string, unsigned int>::iterator d = it->second.begin(); d != it->second.end(); d++)
+            cerr << "drops " << it->first << " " << d->first << ": " << d->second << endl;
+}
+
 class node
 {
     // all nodes created in the program
@@ -989,6 +1777,21 @@ class node
     unsigned int id;
     map<unsigned int, bool> phy_neighbors;
 
+    // a timer of the node; its id is its index in timers
+    class timer_slot
+    {
+    public:
+        unsigned int generation; // bumped by every cancel and reschedule, so the events of older settings are stale
+        unsigned int kind;       // what the timer is for, and data, are given back to timer_handler()
+        unsigned int data;
+        bool in_use;             // the id belongs to a timer
+        bool armed;              // an event of this generation is pending
+    };
+    vector<timer_slot> timers;
+    vector<unsigned int> free_timers;
+    void arm_timer(unsigned int timer, sim_time delay);
+    void deliver(unsigned int nb_id, packet *p);
+
     // you can use the function to get the node's neighbors in HW2
     // But !!! In HW 3, you are not allowed to use this function
     // Please define your own neighbors in GR_node
@@ -1010,13 +1813,25 @@ public:
         id_node_table.erase(id);
     }
 
+    // the state for a checkpoint; a derived node writes and reads its own state after this
+    virtual string type() const = 0;
+    virtual void save(checkpoint_out &out) const { out.put(phy_neighbors), out.put(timers), out.put(free_timers); }
+    virtual void load(checkpoint_in &in);
+    // all the nodes: their ids and types first, so every link can be made when the nodes are loaded
+    static void saveState(checkpoint_out &out);
+    static void loadState(checkpoint_in &in);
+
     void add_phy_neighbor(unsigned int _id, string link_type = "simple_link"); // we only add a directed link from id to _id
     void del_phy_neighbor(unsigned int _id);                                   // we only delete a directed link from id to _id
 
     void recv(packet *p)
     {
         packet *tp = p;
-        recv_handler(tp);
+        sim_stats::record_recv(p, id);
+        {
+            profile_scope scope("recv_handler");
+            recv_handler(tp);
+        }
         packet::discard(p);
     } // the packet will be directly deleted after the handler
     void send(packet *p);
@@ -1024,10 +1839,27 @@ public:
     // receive the packet and do something; this is a pure virtual function
     virtual void recv_handler(packet *p) = 0;
     void send_handler(packet *P);
+    void send_owned(packet *p); // as send_handler, but p itself is sent and must not be used afterwards
 
     static node *id_to_node(unsigned int _id) { return ((id_node_table.find(_id) != id_node_table.end()) ? id_node_table[_id] : nullptr); }
     GET(getNodeID, unsigned int, id);
 
+    // timers: timer_handler(timer, kind, data) is called delay after schedule_timer(), unless the timer is
+    // cancelled or rescheduled first. Both are O(1): the pending event is left in the queue and skipped.
+    // the id of a timer is valid until it is cancelled, or fires and its handler does not reschedule it
+    unsigned int schedule_timer(sim_time delay, unsigned int kind, unsigned int data = 0);
+    bool cancel_timer(unsigned int timer);
+    bool reschedule_timer(unsigned int timer, sim_time delay);
+    bool timer_pending(unsigned int timer) const { return timer < timers.size() && timers[timer].armed; }
+    unsigned int get_timer_num() const { return timers.size() - free_timers.size(); }
+    virtual void timer_handler(unsigned int, unsigned int, unsigned int) {}
+    // for timer_event: whether its generation is the current one of the timer, and its firing
+    bool timer_current(unsigned int timer, unsigned int generation) const
+    {
+        return timer < timers.size() && timers[timer].armed && timers[timer].generation == generation;
+    }
+    void fire_timer(unsigned int timer);
+
     static void del_node(unsigned int _id)
     {
         if (id_node_table.find(_id) != id_node_table.end())
@@ -1086,87 +1918,712 @@ public:
 map<string, node::node_generator *> node::node_generator::prototypes;
 map<unsigned int, node *> node::id_node_table;
 
-class mycomp
+// the event log is formatted into a large buffer; when the buffer is full, it is handed
+// to a background thread which writes it out while the simulation fills the other buffer
+class trace_writer
 {
-    bool reverse;
+    static FILE *out;
+    static string active;  // the buffer being filled by the simulation
+    static string pending; // the buffer being written by the background thread
+    static thread writer;
+    static mutex lock;
+    static condition_variable cond;
+    static bool stopping;
 
-public:
-    mycomp(const bool &revparam = false) { reverse = revparam; }
-    bool operator()(const event *lhs, const event *rhs) const;
-};
+    // the index of the binary log
+    static vector<trace_block> index;
+    static trace_block block; // the block being filled
+    static uint64_t record_num;
 
-class event
-{
-    event(event *&) {} // this constructor cannot be directly called by users
-    static priority_queue<event *, vector<event *>, mycomp> events;
-    static unsigned int cur_time; // timer
-    static unsigned int end_time;
+    static unsigned int sample_count;
 
-    unsigned int trigger_time;
+    static void write_loop();
+    static void hand_off(); // pass the active buffer to the background thread
 
-    // get the next event
-    static event *get_next_event();
-    static void add_event(event *e) { events.push(e); }
-    static hash<string> event_seq;
+public:
+    // whether an event carrying packet p is logged under TRACE_TYPES and TRACE_SAMPLE
+    static bool accept(packet *p);
 
-protected:
-    event() {} // it should not be used
-    event(unsigned int _trigger_time) : trigger_time(_trigger_time) {}
+    static void saveState(checkpoint_out &out) { out.put(sample_count); }
+    static void loadState(checkpoint_in &in) { in.get(sample_count); }
 
-public:
-    virtual void trigger() = 0;
-    virtual ~event() {}
+    static bool open(); // it is called before the first event is logged
+    static void close(); // write out everything and stop the background thread
 
-    virtual unsigned int event_priority() const = 0;
-    unsigned int get_hash_value(string string_for_hash) const
+    static void write(const char *data, size_t len)
     {
-        unsigned int priority = event_seq(string_for_hash);
-        return priority;
+        active.append(data, len);
+        if (active.size() >= TRACE_BUFFER)
+            hand_off();
     }
+    // the log line of a recv_event or a send_event; the layout is the same as the
+    // one produced by "time " << setw(11) << ... << "   nexID" << setw(11) << ... << endl
+    static void write_event(sim_time time, const char *role, unsigned int nodeID, unsigned int pktID,
+                            unsigned int srcID, unsigned int dstID, unsigned int preID, unsigned int nexID);
+};
+FILE *trace_writer::out = nullptr;
+string trace_writer::active;
+string trace_writer::pending;
+thread trace_writer::writer;
+mutex trace_writer::lock;
+condition_variable trace_writer::cond;
+bool trace_writer::stopping = false;
+vector<trace_block> trace_writer::index;
+trace_block trace_writer::block;
+uint64_t trace_writer::record_num = 0;
+unsigned int trace_writer::sample_count = 0;
+
+bool trace_writer::open()
+{
+    if (out != nullptr)
+        return true;
+    out = TRACE_FILE.empty() ? stdout : fopen(TRACE_FILE.c_str(), "wb");
+    if (out == nullptr)
+    {
+        cerr << "cannot open trace file " << TRACE_FILE << endl;
+        return false;
+    }
+    active.reserve(TRACE_BUFFER + 256);
+    pending.reserve(TRACE_BUFFER + 256);
+    if (TRACE_BINARY)
+    {
+        trace_file_header h;
+        memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+        h.version = TRACE_VERSION;
+        h.record_size = sizeof(trace_record);
+        active.append((const char *)&h, sizeof(h));
+        trace_block_reset(block, 0);
+    }
+    writer = thread(write_loop);
+    atexit(close);
+    return true;
+}
 
-    static void flush_events(); // only for debug
-
-    GET(getTriggerTime, unsigned int, trigger_time);
-
-    static void start_simulate(unsigned int _end_time); // the function is used to start the simulation
-
-    static unsigned int getCurTime() { return cur_time; }
-    static void getCurTime(unsigned int _cur_time) { cur_time = _cur_time; }
-    // static unsigned int getEndTime() { return end_time ; }
-    // static void getEndTime(unsigned int _end_time) { end_time = _end_time; }
+void trace_writer::write_loop()
+{
+    unique_lock<mutex> guard(lock);
+    while (true)
+    {
+        cond.wait(guard, [] { return !pending.empty() || stopping; });
+        if (pending.empty())
+            return; // stopping and nothing left
+        guard.unlock();
+        fwrite(pending.data(), 1, pending.size(), out);
+        guard.lock();
+        pending.clear();
+        cond.notify_all();
+    }
+}
 
-    virtual void print() const = 0; // the function is used to print the event information
+void trace_writer::hand_off()
+{
+    unique_lock<mutex> guard(lock);
+    cond.wait(guard, [] { return pending.empty(); }); // the previous buffer has been written
+    pending.swap(active);
+    cond.notify_all();
+}
 
-    class event_generator
+void trace_writer::close()
+{
+    if (out == nullptr)
+        return;
+    if (TRACE_BINARY)
     {
-        // lock the copy constructor
-        event_generator(event_generator &) {}
-        // store all possible types of event
-        static map<string, event_generator *> prototypes;
+        // append the index and the footer after the records
+        if (block.record_num > 0)
+            index.push_back(block);
+        trace_footer f;
+        f.index_offset = sizeof(trace_file_header) + record_num * sizeof(trace_record);
+        f.block_num = index.size();
+        f.record_num = record_num;
+        memcpy(f.magic, TRACE_INDEX_MAGIC, sizeof(f.magic));
+        if (!index.empty())
+            active.append((const char *)index.data(), index.size() * sizeof(trace_block));
+        active.append((const char *)&f, sizeof(f));
+        index.clear();
+    }
+    if (!active.empty())
+        hand_off();
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    cond.notify_all();
+    writer.join();
+    fflush(out);
+    if (out != stdout)
+        fclose(out);
+    out = nullptr;
+}
+
+void trace_writer::write_event(sim_time time, const char *role, unsigned int nodeID, unsigned int pktID,
+                               unsigned int srcID, unsigned int dstID, unsigned int preID, unsigned int nexID)
+{
+    trace_record r;
+    trace_record_set(r, time, (role[0] == 's') ? TRACE_SEND : TRACE_RECV, nodeID, pktID, srcID, dstID, preID, nexID);
+    if (TRACE_BINARY)
+    {
+        trace_block_add(block, r);
+        record_num++;
+        if (block.record_num == TRACE_BLOCK_RECORDS)
+        {
+            index.push_back(block);
+            trace_block_reset(block, record_num);
+        }
+        write((const char *)&r, sizeof(r));
+        return;
+    }
+    char line[TRACE_LINE_MAX];
+    write(line, format_trace_line(line, r) - line);
+}
+
+bool trace_writer::accept(packet *p)
+{
+    if (!TRACE_TYPES.empty() && TRACE_TYPES.find(p->type()) == TRACE_TYPES.end())
+        return false;
+    return TRACE_SAMPLE <= 1 || sample_count++ % TRACE_SAMPLE == 0;
+}
+
+// the flight recorder of --flight-recorder: a ring of the last FLIGHT_RECORDS events in the binary
+// format of the event log. It is filled even with --trace=off and dumped to FLIGHT_FILE by an error
+// path, by SIGUSR1, SIGINT or SIGTERM (at the next event) and by SIGSEGV or SIGABRT, so trace_decode
+// can show what led there. A fatal signal may arrive inside malloc or stdio, so its handler only uses
+// write(2) on the file opened at the start and the ring allocated there
+class flight_recorder
+{
+    static vector<trace_record> ring;
+    static uint64_t total; // the events recorded so far; the next one goes to ring[total % ring.size()]
+    static bool dumped;
+    static int fd;        // FLIGHT_FILE; -1 if it cannot be opened
+    static bool created;  // FLIGHT_FILE did not exist; it is removed at exit if nothing was dumped to it
+    static bool written;
+    static volatile sig_atomic_t requested; // SIGUSR1 arrived
+    static volatile sig_atomic_t stopping;  // SIGINT or SIGTERM arrived
+
+    static void on_request(int) { requested = 1; }
+    static void on_stop(int sig)
+    {
+        stopping = sig;
+        signal(sig, SIG_DFL); // a second one ends the run at once
+    }
+    static void on_fatal(int sig);
+    static bool write_all(const void *data, size_t size);
+    static bool write_ring(); // async-signal-safe
+    static void remove_unused();
+
+public:
+    static void open();
+    static bool on() { return !ring.empty(); }
+    // the slot of the next event; it is kept only if commit() follows
+    static trace_record &slot() { return ring[total % ring.size()]; }
+    static void commit() { total++; }
+    static bool pending_request() { return requested != 0 || stopping != 0; }
+    // the dump asked for by a signal; after SIGINT or SIGTERM the signal is raised again
+    static void serve_request();
+    // write the ring out oldest first; with once, only the first error of the run is dumped
+    static void dump(const char *reason, bool once = true);
+};
+vector<trace_record> flight_recorder::ring;
+uint64_t flight_recorder::total = 0;
+bool flight_recorder::dumped = false;
+int flight_recorder::fd = -1;
+bool flight_recorder::created = false;
+bool flight_recorder::written = false;
+volatile sig_atomic_t flight_recorder::requested = 0;
+volatile sig_atomic_t flight_recorder::stopping = 0;
+
+void flight_recorder::open()
+{
+    if (FLIGHT_RECORDS == 0 || on())
+        return;
+    ring.resize(FLIGHT_RECORDS);
+    fd = ::open(FLIGHT_FILE.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    created = (fd >= 0);
+    if (fd < 0)
+        fd = ::open(FLIGHT_FILE.c_str(), O_WRONLY); // an older dump is replaced only by a new one
+    if (fd < 0)
+        cerr << "flight recorder: cannot open " << FLIGHT_FILE << endl;
+    if (created)
+        atexit(remove_unused);
+    signal(SIGUSR1, on_request);
+    signal(SIGINT, on_stop);
+    signal(SIGTERM, on_stop);
+    signal(SIGSEGV, on_fatal);
+    signal(SIGABRT, on_fatal);
+}
+
+void flight_recorder::remove_unused()
+{
+    if (!written)
+        remove(FLIGHT_FILE.c_str());
+}
+
+void flight_recorder::on_fatal(int sig)
+{
+    signal(sig, SIG_DFL);
+    const char *parts[] = {(sig == SIGSEGV) ? "flight recorder: SIGSEGV; " : "flight recorder: SIGABRT; ",
+                           write_ring() ? "the last events are in " : "cannot write ", FLIGHT_FILE.c_str(), "\n"};
+    for (const char *part : parts)
+        if (write(STDERR_FILENO, part, strlen(part)) < 0)
+            break;
+    raise(sig);
+}
+
+bool flight_recorder::write_all(const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool flight_recorder::write_ring()
+{
+    if (fd < 0 || lseek(fd, 0, SEEK_SET) != 0 || ftruncate(fd, 0) != 0)
+        return false;
+    uint64_t num = total < ring.size() ? total : ring.size(), first = total - num;
+    trace_file_header h;
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.version = TRACE_VERSION;
+    h.record_size = sizeof(trace_record);
+    // the records oldest first; they wrap around the end of the ring at most once
+    size_t begin = first % ring.size(), tail = (num < ring.size() - begin) ? num : ring.size() - begin;
+    bool ok = write_all(&h, sizeof(h)) && write_all(&ring[begin], tail * sizeof(trace_record)) &&
+              write_all(&ring[0], (num - tail) * sizeof(trace_record));
+    // the index, one block at a time
+    uint64_t block_num = 0;
+    for (uint64_t i = 0; ok && i < num; i += TRACE_BLOCK_RECORDS, block_num++)
+    {
+        trace_block block;
+        trace_block_reset(block, i);
+        for (uint64_t k = i; k < num && k < i + TRACE_BLOCK_RECORDS; k++)
+            trace_block_add(block, ring[(first + k) % ring.size()]);
+        ok = write_all(&block, sizeof(block));
+    }
+    trace_footer footer;
+    footer.index_offset = sizeof(trace_file_header) + num * sizeof(trace_record);
+    footer.block_num = block_num;
+    footer.record_num = num;
+    memcpy(footer.magic, TRACE_INDEX_MAGIC, sizeof(footer.magic));
+    return ok && write_all(&footer, sizeof(footer));
+}
+
+void flight_recorder::serve_request()
+{
+    if (requested != 0)
+    {
+        requested = 0;
+        dump("SIGUSR1", false);
+    }
+    if (stopping != 0)
+    {
+        dump(stopping == SIGINT ? "SIGINT" : "SIGTERM", false);
+        raise(stopping); // its handler is the default one again
+    }
+}
+
+void flight_recorder::dump(const char *reason, bool once)
+{
+    if (!on() || (once && dumped))
+        return;
+    if (once)
+        dumped = true;
+    if (!write_ring())
+    {
+        fprintf(stderr, "flight recorder: %s; cannot write %s\n", reason, FLIGHT_FILE.c_str());
+        return;
+    }
+    written = true;
+    uint64_t num = total < ring.size() ? total : ring.size();
+    fprintf(stderr, "flight recorder: %s; the last %llu events are in %s (see trace_decode)\n", reason,
+            (unsigned long long)num, FLIGHT_FILE.c_str());
+}
+
+// the dequeue order of --record and --replay. Events of the same time are ordered by event_priority(),
+// which comes from hash<string> and so differs between standard libraries; a replay triggers them in
+// the recorded order instead and reports the first event it cannot find.
+// file layout: REPLAY_MAGIC, then per event the varints
+//   time - the time of the previous event, type index, sender, receiver, zigzag(id - the previous id)
+// where id is event::getEventID(): the packet id, or the timer id of a timer_event
+// a type index equal to the number of types seen so far is followed by the varint length and the type name
+class replay_log
+{
+public:
+    // what identifies an event in the log
+    class key
+    {
+    public:
+        sim_time time;
+        string type;
+        unsigned int sender, receiver, id;
+        bool matches(const event *e) const;
+        string str() const;
+    };
+
+private:
+    static FILE *file;
+    static bool writing;
+    static bool diverged_flag, ended;
+    static vector<string> types;
+    static key last;
+    static unsigned long long count;
+
+    static void put_varint(unsigned long long v)
+    {
+        while (v >= 0x80)
+        {
+            putc((int)(v & 0x7f) | 0x80, file);
+            v >>= 7;
+        }
+        putc((int)v, file);
+    }
+    static bool get_varint(unsigned long long &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int c = getc(file);
+            if (c == EOF)
+                return false;
+            v |= (unsigned long long)(c & 0x7f) << shift;
+            if ((c & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+public:
+    static bool open();
+    static void close();
+    static bool recording() { return file != nullptr && writing; }
+    static bool replaying() { return file != nullptr && !writing && !diverged_flag && !ended; }
+    static bool diverged() { return diverged_flag; }
+    static key of(const event *e);
+    static void record(const event *e);
+    // the next recorded event; false at the end of the log
+    static bool next(key &k);
+    // report the first divergence; the rest of the run follows event_priority()
+    static void diverge(const string &what, const vector<event *> &candidates);
+};
+FILE *replay_log::file = nullptr;
+bool replay_log::writing = false;
+bool replay_log::diverged_flag = false;
+bool replay_log::ended = false;
+vector<string> replay_log::types;
+replay_log::key replay_log::last;
+unsigned long long replay_log::count = 0;
+
+const char REPLAY_MAGIC[8] = {'G', 'R', 'R', 'E', 'P', 'L', 'Y', '3'};
+
+bool replay_log::open()
+{
+    if (RECORD_FILE.empty() && REPLAY_FILE.empty())
+        return true;
+    writing = !RECORD_FILE.empty();
+    const string &path = writing ? RECORD_FILE : REPLAY_FILE;
+    file = fopen(path.c_str(), writing ? "wb" : "rb");
+    if (file == nullptr)
+    {
+        cerr << "cannot open replay log " << path << endl;
+        return false;
+    }
+    last.time = last.id = 0;
+    char magic[sizeof(REPLAY_MAGIC)];
+    if (writing)
+        fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC), file);
+    else if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0)
+    {
+        cerr << path << " is not a replay log" << endl;
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void replay_log::close()
+{
+    if (file == nullptr)
+        return;
+    key k;
+    if (!writing && !diverged_flag && !ended && next(k))
+        cerr << "replay: the run ended before the recorded event " << count << " (" << k.str() << ")" << endl;
+    if (writing)
+        cerr << "record: " << count << " events written to " << RECORD_FILE << endl;
+    else if (!diverged_flag)
+        cerr << "replay: " << count << " events followed the record" << endl;
+    fclose(file);
+    file = nullptr;
+}
+
+void replay_log::record(const event *e)
+{
+    key k = of(e);
+    put_varint(k.time - last.time);
+    size_t t = 0;
+    while (t < types.size() && types[t] != k.type)
+        t++;
+    put_varint(t);
+    if (t == types.size())
+    {
+        types.push_back(k.type);
+        put_varint(k.type.size());
+        fwrite(k.type.data(), 1, k.type.size(), file);
+    }
+    put_varint(k.sender);
+    put_varint(k.receiver);
+    long long d = (long long)k.id - (long long)last.id;
+    put_varint(((unsigned long long)d << 1) ^ (unsigned long long)(d >> 63));
+    last = k;
+    count++;
+}
+
+bool replay_log::next(key &k)
+{
+    unsigned long long dt, t, len, s, r, z;
+    if (!get_varint(dt) || !get_varint(t))
+        return false;
+    if (t == types.size())
+    {
+        string name;
+        if (!get_varint(len) || len > 256)
+            return false;
+        name.resize(len);
+        if (fread(&name[0], 1, len, file) != len)
+            return false;
+        types.push_back(name);
+    }
+    if (t >= types.size() || !get_varint(s) || !get_varint(r) || !get_varint(z))
+        return false;
+    k.time = last.time + dt;
+    k.type = types[t];
+    k.sender = (unsigned int)s;
+    k.receiver = (unsigned int)r;
+    k.id = (unsigned int)(last.id + (long long)((z >> 1) ^ (~(z & 1) + 1)));
+    last = k;
+    count++;
+    return true;
+}
+
+string replay_log::key::str() const
+{
+    return "time " + time_to_string(time) + " " + type + " " + to_string(sender) + " -> " + to_string(receiver) + " id " +
+           to_string(id);
+}
+
+void replay_log::diverge(const string &what, const vector<event *> &candidates)
+{
+    diverged_flag = true;
+    cerr << "replay: diverged at event " << count << ": " << what << endl;
+    for (size_t i = 0; i < candidates.size() && i < 10; i++)
+        cerr << "  pending: " << of(candidates[i]).str() << endl;
+    if (candidates.size() > 10)
+        cerr << "  ... " << candidates.size() - 10 << " more" << endl;
+    cerr << "replay: the rest of the run follows event_priority()" << endl;
+}
+
+// the whole state of the simulation for --checkpoint and --restore (see checkpoint_format.h); the
+// routing options are restored with it, since the tables of the nodes were built under them
+class checkpoint
+{
+public:
+    static bool save(const string &path);
+    static bool load(const string &path);
+};
+
+// the traffic pairs which are injected while the simulation runs (see --stream-traffic)
+class traffic_source
+{
+public:
+    virtual ~traffic_source() {}
+    // the start time of the next pair; false if there is no more pair or the input is wrong
+    virtual bool peek(unsigned int &t) = 0;
+    // add the initial event of the next pair
+    virtual void inject() = 0;
+    // the next pair starts at t instead (t is later than its start time)
+    virtual void delay(unsigned int t) = 0;
+    virtual bool failed() const = 0;
+    // the packet ids kept for the pairs not injected yet: the first one and their number
+    virtual void reserved_ids(unsigned int &first, unsigned int &num) const = 0;
+};
+
+class mycomp
+{
+    bool reverse;
+
+public:
+    mycomp(const bool &revparam = false) { reverse = revparam; }
+    bool operator()(const event *lhs, const event *rhs) const;
+};
+
+class event
+{
+    event(event *&) {} // this constructor cannot be directly called by users
+    static priority_queue<event *, vector<event *>, mycomp> events;
+    static sim_time cur_time; // timer
+    static sim_time end_time;
+    static traffic_source *traffic; // the pairs not injected yet; nullptr if all of them are preloaded
+    // the traffic pairs put into the queue so far, preloaded or injected; a checkpoint keeps the number,
+    // so that a restore skips those pairs when it reads the traffic again
+    static unsigned long long traffic_pairs;
+    static unsigned int traffic_first_id, traffic_id_num; // the ids a restored stream goes on with
+    static unsigned long long processed; // the events triggered so far
+    static size_t peak_pending;          // the largest number of events waiting at once
+    static int peak_live_packets;
+    // the wall clock of --progress
+    static chrono::steady_clock::time_point progress_begin, progress_last;
+    static unsigned long long progress_last_events;
+    static void print_progress(bool final);
+
+    sim_time trigger_time;
+    unsigned int type_index; // the index of its event_generator, set by the generator
+
+    // get the next event
+    static event *get_next_event();
+    // the next event in the order of --replay; the events of the same time looked at before it are held
+    static vector<event *> held;
+    static event *replay_next_event();
+    static hash<string> event_seq;
+    static bool inject_traffic();
+    // the cancelled events still in the queue (see cancelled()); they are deleted when they reach the top,
+    // or all at once by purge_cancelled() when they become most of the queue
+    static size_t cancelled_num;
+    static event *running; // the event being triggered
+    static void drop_cancelled();
+    static void purge_cancelled();
+
+protected:
+    event() {} // it should not be used
+    event(sim_time _trigger_time) : trigger_time(_trigger_time), type_index(0) {}
+    static void add_event(event *e) { events.push(e); }
+    SET(setTriggerTime, sim_time, trigger_time, _trigger_time);
+
+public:
+    virtual void trigger() = 0;
+    virtual ~event() {}
+
+    virtual unsigned int event_priority() const = 0;
+    virtual string type() const = 0;
+    unsigned int get_hash_value(string string_for_hash) const
+    {
+        unsigned int priority = event_seq(string_for_hash);
+        return priority;
+    }
+
+    static void flush_events(); // only for debug
+    static void discard_events(); // delete the pending events and their packets without triggering them
+    virtual packet *getPacket() const { return nullptr; }
+    virtual unsigned int getSenderID() const { return BROCAST_ID; }
+    virtual unsigned int getReceiverID() const { return BROCAST_ID; }
+    // with the type, time and nodes, tells the event apart from the others in a replay log
+    virtual unsigned int getEventID() const { return getPacket() != nullptr ? getPacket()->getPacketID() : UINT_MAX; }
+    GET(getTypeIndex, unsigned int, type_index); // a small number per event type, for the counters
+    virtual bool to_record(trace_record &) const { return false; } // the event as a line of the binary log
+    // a cancelled event stays in the queue and is deleted without being triggered
+    virtual bool cancelled() const { return false; }
+    // true if trigger() put the event back into the queue, so it must not be deleted
+    virtual bool requeued() const { return false; }
+    // count an event which has just been cancelled, or a cancelled one deleted out of the queue
+    static void count_cancelled();
+    static void uncount_cancelled()
+    {
+        if (cancelled_num != 0)
+            cancelled_num--;
+    }
+    // the data of the event for a checkpoint; event_generator::restore() reads it back
+    virtual void save(checkpoint_out &out) const = 0;
+    // the clock, the counters, the traffic scheduled so far and the pending events, for a checkpoint
+    static void saveState(checkpoint_out &out);
+    static void loadState(checkpoint_in &in);
+
+    GET(getTriggerTime, sim_time, trigger_time);
+
+    static void start_simulate(sim_time _end_time); // the function is used to start the simulation
+    static void setTrafficSource(traffic_source *_traffic) { traffic = _traffic; }
+    static void countTrafficPair() { traffic_pairs++; }
+    static unsigned long long getTrafficPairs() { return traffic_pairs; }
+    // the packet ids the stream of a checkpointed run had kept for its pairs (see reserved_ids())
+    static void getTrafficIDs(unsigned int &first, unsigned int &num) { first = traffic_first_id, num = traffic_id_num; }
+    static unsigned long long getProcessed() { return processed; }
+    static size_t getPeakPending() { return peak_pending; }
+    static size_t getPendingNum() { return events.size(); }
+    static map<string, size_t> getPendingTypes(); // "event type packet type" -> pending events; copies the queue
+    static int getPeakLivePackets() { return peak_live_packets; }
+
+    static sim_time getCurTime() { return cur_time; }
+    static void getCurTime(sim_time _cur_time) { cur_time = _cur_time; }
+    // static sim_time getEndTime() { return end_time ; }
+    // static void getEndTime(sim_time _end_time) { end_time = _end_time; }
+
+    virtual void print() const = 0; // the function is used to print the event information
+
+    class event_generator
+    {
+        // lock the copy constructor
+        event_generator(event_generator &) {}
+        // store all possible types of event
+        static map<string, event_generator *> prototypes;
+        static unsigned int type_num;
+        unsigned int index; // the number of event types registered before this one
 
     protected:
         // allow derived class to use it
-        event_generator() {}
+        event_generator() : index(0) {}
         // after you create a new event type, please register the factory of this event type by this function
-        void register_event_type(event_generator *h) { prototypes[h->type()] = h; }
+        void register_event_type(event_generator *h)
+        {
+            h->index = type_num++;
+            prototypes[h->type()] = h;
+        }
         // you have to implement your own generate() to generate your event
-        virtual event *generate(unsigned int _trigger_time, void *data) = 0;
+        virtual event *generate(sim_time _trigger_time, void *data) = 0;
+        // and load() to generate it from the data written by its save()
+        virtual event *load(sim_time _trigger_time, checkpoint_in &in) = 0;
 
     public:
         // you have to implement your own type() to return your event type
         virtual string type() = 0;
         // this function is used to generate any type of event derived
-        static event *generate(string type, unsigned int _trigger_time, void *data)
+        static event *generate(string type, sim_time _trigger_time, void *data)
         {
-            if (prototypes.find(type) != prototypes.end())
+            map<string, event_generator *>::iterator it = prototypes.find(type);
+            if (it != prototypes.end())
             { // if this type derived exists
-                event *e = prototypes[type]->generate(_trigger_time, data);
+                event *e = it->second->generate(_trigger_time, data);
+                e->type_index = it->second->index;
+                profile_scope scope("heap_push");
                 add_event(e);
                 return e; // generate it!!
             }
             std::cerr << "no such event type" << std::endl; // otherwise
             return nullptr;
         }
+        // generate an event of a checkpoint and add it
+        static event *restore(string type, sim_time _trigger_time, checkpoint_in &in)
+        {
+            if (prototypes.find(type) == prototypes.end())
+            {
+                std::cerr << "no such event type" << std::endl;
+                in.fail();
+                return nullptr;
+            }
+            event_generator *g = prototypes[type];
+            event *e = g->load(_trigger_time, in);
+            if (e != nullptr)
+            {
+                e->type_index = g->index;
+                add_event(e);
+            }
+            return e;
+        }
         static void print()
         {
             cout << "registered event types: " << endl;
@@ -1177,25 +2634,322 @@ public:
     };
 };
 map<string, event::event_generator *> event::event_generator::prototypes;
+unsigned int event::event_generator::type_num = 0;
 priority_queue<event *, vector<event *>, mycomp> event::events;
 hash<string> event::event_seq;
 
-unsigned int event::cur_time = 0;
-unsigned int event::end_time = 0;
+sim_time event::cur_time = 0;
+sim_time event::end_time = 0;
+traffic_source *event::traffic = nullptr;
+unsigned long long event::traffic_pairs = 0;
+unsigned int event::traffic_first_id = UINT_MAX;
+unsigned int event::traffic_id_num = 0;
+unsigned long long event::processed = 0;
+size_t event::peak_pending = 0;
+int event::peak_live_packets = 0;
+chrono::steady_clock::time_point event::progress_begin;
+chrono::steady_clock::time_point event::progress_last;
+unsigned long long event::progress_last_events = 0;
+vector<event *> event::held;
+size_t event::cancelled_num = 0;
+event *event::running = nullptr;
+
+void sim_stats::record_delivery(packet *p, unsigned int nodeID)
+{
+    unsigned int t = p->getTypeIndex();
+    if (t >= hop_slots.size())
+        hop_slots.resize(t + 1, nullptr);
+    if (hop_slots[t] == nullptr)
+        hop_slots[t] = &hop_hist[p->type()];
+    (*hop_slots[t])[p->getHeader()->getHopNum()]++;
+    of_type(p).delivered++;
+    of_node(nodeID).delivered++;
+    if (GR_header *hdr = dynamic_cast<GR_header *>(p->getHeader()))
+    {
+        gr_latency[event::getCurTime() - hdr->getStartTime()]++;
+        gr_hops[hdr->getHopNum()]++;
+    }
+}
+
+void sim_stats::record_event(const event *e)
+{
+    unsigned int t = e->getTypeIndex();
+    if (t >= event_slots.size())
+        event_slots.resize(t + 1, NO_SLOT);
+    if (event_slots[t] == NO_SLOT)
+        event_slots[t] = slot_of(e->type(), event_names, event_counts);
+    event_counts[event_slots[t]]++;
+}
+
+void event::saveState(checkpoint_out &out)
+{
+    out.put(cur_time), out.put(processed), out.put(peak_pending), out.put(peak_live_packets), out.put(traffic_pairs);
+    unsigned int first_id = UINT_MAX, id_num = 0;
+    if (traffic != nullptr)
+        traffic->reserved_ids(first_id, id_num);
+    out.put(first_id), out.put(id_num);
+    out.put((uint64_t)events.size());
+    priority_queue<event *, vector<event *>, mycomp> pending = events;
+    for (; !pending.empty(); pending.pop())
+    {
+        out.put(pending.top()->type());
+        out.put(pending.top()->trigger_time);
+        pending.top()->save(out);
+    }
+}
+void event::loadState(checkpoint_in &in)
+{
+    uint64_t num = 0;
+    in.get(cur_time), in.get(processed), in.get(peak_pending), in.get(peak_live_packets), in.get(traffic_pairs);
+    in.get(traffic_first_id), in.get(traffic_id_num);
+    in.get(num);
+    for (uint64_t i = 0; i < num && !in.failed(); i++)
+    {
+        string type;
+        sim_time t = 0;
+        in.get(type);
+        in.get(t);
+        event *e = in.failed() ? nullptr : event_generator::restore(type, t, in);
+        if (e != nullptr && e->cancelled())
+            cancelled_num++;
+    }
+}
+
+map<string, size_t> event::getPendingTypes()
+{
+    map<string, size_t> types;
+    priority_queue<event *, vector<event *>, mycomp> pending = events;
+    for (; !pending.empty(); pending.pop())
+    {
+        packet *p = pending.top()->getPacket();
+        types[pending.top()->type() + " " + (p != nullptr ? p->type() : "none")]++;
+    }
+    return types;
+}
+
+// the event storm watchdog of --max-events and --max-packets; check() runs after every event and the
+// policy acts while the storm lasts: "drop" stops node::send from sending the STORM_DROP types, "delay"
+// postpones the traffic pairs of --stream-traffic and "abort" dumps the top talkers and stops the run
+class watchdog
+{
+    static bool storming;
+    static bool stopped;
+    static unsigned long long storms, dropped, delayed;
+
+public:
+    static void check();
+    static bool admit(packet *p) { return !storming || STORM_POLICY != "drop" || STORM_DROP.find(p->type()) == STORM_DROP.end(); }
+    static bool delaying() { return storming && STORM_POLICY == "delay"; }
+    static void count_drop() { dropped++; }
+    static void count_delay() { delayed++; }
+    static bool aborted() { return stopped; }
+};
+bool watchdog::storming = false;
+bool watchdog::stopped = false;
+unsigned long long watchdog::storms = 0;
+unsigned long long watchdog::dropped = 0;
+unsigned long long watchdog::delayed = 0;
+
+void watchdog::check()
+{
+    size_t pending = event::getPendingNum();
+    int live = packet::getLivePacketNum();
+    bool storm = (MAX_EVENTS != 0 && pending > MAX_EVENTS) || (MAX_PACKETS != 0 && live > MAX_PACKETS);
+    if (storm == storming)
+        return;
+    storming = storm;
+    if (!storm)
+    {
+        cerr << "watchdog: the storm is over at time " << time_to_string(event::getCurTime()) << " (" << dropped << " packets dropped, "
+             << delayed << " pair delays so far)" << endl;
+        return;
+    }
+    storms++;
+    cerr << "watchdog: storm at time " << time_to_string(event::getCurTime()) << ": " << pending << " pending events, " << live
+         << " live packets; policy " << STORM_POLICY << endl;
+    if (STORM_POLICY != "abort")
+        return;
+    sim_stats::print_top_talkers(cerr, 10);
+    cerr << "pending events:" << endl;
+    map<string, size_t> types = event::getPendingTypes();
+    for (map<string, size_t>::iterator it = types.begin(); it != types.end(); it++)
+        cerr << "  " << it->first << ": " << it->second << endl;
+    stopped = true;
+}
 
 void event::flush_events()
 {
     cout << "**flush begin" << endl;
     while (!events.empty())
     {
-        cout << setw(11) << events.top()->trigger_time << ": " << setw(11) << events.top()->event_priority() << endl;
+        cout << setw(11) << time_to_string(events.top()->trigger_time) << ": " << setw(11) << events.top()->event_priority() << endl;
         delete events.top();
         events.pop();
     }
     cout << "**flush end" << endl;
 }
+// inject the traffic pairs which start no later than the earliest pending event, so they are ordered
+// against it exactly as if they had been preloaded
+bool event::inject_traffic()
+{
+    unsigned int t; // in whole ticks, as in the scenario
+    while (traffic != nullptr && traffic->peek(t) && ticks_to_time(t) <= end_time)
+    {
+        if (!events.empty() && ticks_to_time(t) > events.top()->trigger_time)
+            break;
+        if (watchdog::delaying())
+        {
+            traffic->delay(t + STORM_DELAY);
+            watchdog::count_delay();
+            continue;
+        }
+        traffic->inject();
+    }
+    return traffic == nullptr || !traffic->failed();
+}
+void event::discard_events()
+{
+    while (!events.empty())
+    {
+        packet *p = events.top()->getPacket();
+        packet::discard(p);
+        delete events.top();
+        events.pop();
+    }
+    cancelled_num = 0;
+}
+void event::count_cancelled()
+{
+    cancelled_num++;
+    if (cancelled_num >= 4096 && cancelled_num * 2 > events.size())
+        purge_cancelled();
+}
+void event::drop_cancelled()
+{
+    while (cancelled_num != 0 && !events.empty() && events.top()->cancelled())
+    {
+        delete events.top();
+        events.pop();
+        cancelled_num--;
+    }
+}
+// rebuild the queue without the cancelled events; this costs as much as the cancellations it follows
+// the event being triggered may have requeued itself; the event loop still uses it, so it is kept
+void event::purge_cancelled()
+{
+    vector<event *> live;
+    live.reserve(events.size());
+    size_t kept = 0;
+    for (; !events.empty(); events.pop())
+    {
+        event *e = events.top();
+        if (!e->cancelled())
+            live.push_back(e);
+        else if (e == running)
+        {
+            live.push_back(e);
+            kept++;
+        }
+        else
+            delete e;
+    }
+    events = priority_queue<event *, vector<event *>, mycomp>(mycomp(), live);
+    cancelled_num = kept;
+}
+replay_log::key replay_log::of(const event *e)
+{
+    key k;
+    k.time = e->getTriggerTime();
+    k.type = e->type();
+    k.sender = e->getSenderID();
+    k.receiver = e->getReceiverID();
+    k.id = e->getEventID();
+    return k;
+}
+bool replay_log::key::matches(const event *e) const
+{
+    key k = of(e);
+    return k.time == time && k.sender == sender && k.receiver == receiver && k.id == id && k.type == type;
+}
+
+event *event::replay_next_event()
+{
+    replay_log::key want;
+    if (!replay_log::next(want))
+    {
+        if (!events.empty() && events.top()->trigger_time <= end_time)
+            replay_log::diverge("the record ends before the run", held);
+        for (size_t i = 0; i < held.size(); i++)
+            events.push(held[i]);
+        held.clear();
+        return nullptr; // the caller pops the queue
+    }
+    // the record triggers its events in time order, so an event pending before want has left it: a held
+    // event which was cancelled meanwhile is deleted, any other one is a divergence, reported before the
+    // clock passes it
+    for (size_t i = 0; i < held.size();)
+        if (held[i]->cancelled())
+        {
+            delete held[i];
+            held.erase(held.begin() + i);
+            uncount_cancelled();
+        }
+        else
+            i++;
+    drop_cancelled();
+    const event *early = nullptr;
+    for (size_t i = 0; i < held.size() && early == nullptr; i++)
+        if (held[i]->trigger_time < want.time)
+            early = held[i];
+    if (early == nullptr && !events.empty() && events.top()->trigger_time < want.time)
+        early = events.top();
+    if (early != nullptr)
+    {
+        vector<event *> candidates = held;
+        if (!events.empty())
+            candidates.push_back(events.top());
+        replay_log::diverge("the pending " + replay_log::of(early).str() + " is before the recorded " + want.str(), candidates);
+        for (size_t i = 0; i < held.size(); i++)
+            events.push(held[i]);
+        held.clear();
+        return nullptr;
+    }
+    while (true)
+    {
+        for (size_t i = 0; i < held.size(); i++)
+            if (want.matches(held[i]))
+            {
+                event *e = held[i];
+                held.erase(held.begin() + i);
+                return e;
+            }
+        drop_cancelled();
+        if (events.empty() || events.top()->trigger_time != want.time)
+            break;
+        held.push_back(events.top());
+        events.pop();
+    }
+    vector<event *> candidates = held;
+    if (!events.empty())
+        candidates.push_back(events.top());
+    replay_log::diverge("the recorded " + want.str() + " is not pending", candidates);
+    for (size_t i = 0; i < held.size(); i++)
+        events.push(held[i]);
+    held.clear();
+    return nullptr;
+}
+
 event *event::get_next_event()
 {
+    drop_cancelled(); // before the traffic is ordered against the top of the queue
+    if (!inject_traffic())
+        return nullptr;
+    if (replay_log::replaying())
+    {
+        event *e = replay_next_event();
+        if (e != nullptr)
+            return e;
+    }
     if (events.empty())
         return nullptr;
     event *e = events.top();
@@ -1203,35 +2957,142 @@ event *event::get_next_event()
     // cout << events.size() << " events remains" << endl;
     return e;
 }
-void event::start_simulate(unsigned int _end_time)
+void event::start_simulate(sim_time _end_time)
 {
-    if (_end_time < 0)
-    {
-        cerr << "you should give a positive value of _end_time" << endl;
-        return;
-    }
     end_time = _end_time;
+    if (TRACE_ON && !trace_writer::open())
+        return;
+    flight_recorder::open();
+    if (!replay_log::open())
+        return;
     event *e;
+    if (events.size() > peak_pending)
+        peak_pending = events.size();
+    progress_begin = progress_last = chrono::steady_clock::now();
+    progress_last_events = processed;
     e = event::get_next_event();
     while (e != nullptr && e->trigger_time <= end_time)
     {
+        if (e->trigger_time > CHECKPOINT_AT)
+        {
+            // the checkpoint is taken between the last event at CHECKPOINT_AT and e, which is still pending
+            events.push(e);
+            CHECKPOINT_AT = SIM_TIME_MAX;
+            if (!checkpoint::save(CHECKPOINT_FILE))
+                break;
+            e = events.top();
+            events.pop();
+        }
         if (cur_time <= e->trigger_time)
             cur_time = e->trigger_time;
         else
         {
-            cerr << "cur_time = " << cur_time << ", event trigger_time = " << e->trigger_time << endl;
-            break;
+            cerr << "cur_time = " << time_to_string(cur_time) << ", event trigger_time = " << time_to_string(e->trigger_time) << endl;
+            flight_recorder::dump("an event before the current time");
+            break;
+        }
+
+        // cout << "event trigger_time = " << e->trigger_time << endl;
+        if (!PROFILE.empty())
+            profiler::next_event(cur_time, events.size() + 1);
+        if (STATS_INTERVAL != 0)
+            sim_stats::dump(cur_time, false);
+        if (replay_log::recording())
+            replay_log::record(e);
+        if (flight_recorder::on())
+        {
+            if (e->to_record(flight_recorder::slot()))
+                flight_recorder::commit();
+            if (flight_recorder::pending_request())
+                flight_recorder::serve_request();
+        }
+        if (TRACE_ON)
+        {
+            profile_scope scope("print");
+            e->print(); // for log
+        }
+        sim_stats::record_event(e);
+        // cout << " event begin" << endl;
+        running = e;
+        if (profiler::active)
+        {
+            packet *p = e->getPacket();
+            profiler::enter_trigger(e->type(), p != nullptr ? p->type() : "none");
+            e->trigger();
+            profiler::leave_trigger();
+        }
+        else
+            e->trigger();
+        running = nullptr;
+        // cout << " event end" << endl;
+        if (!e->requeued())
+        {
+            profile_scope scope("delete");
+            delete e;
+        }
+        processed++;
+        if (events.size() > peak_pending)
+            peak_pending = events.size();
+        if (packet::getLivePacketNum() > peak_live_packets)
+            peak_live_packets = packet::getLivePacketNum();
+        if (MAX_EVENTS != 0 || MAX_PACKETS != 0)
+        {
+            watchdog::check();
+            if (watchdog::aborted())
+                break;
+        }
+        if (PROGRESS_INTERVAL != 0 && processed % 256 == 0)
+            print_progress(false);
+        {
+            profile_scope scope("pop");
+            e = event::get_next_event();
         }
-
-        // cout << "event trigger_time = " << e->trigger_time << endl;
-        e->print(); // for log
-        // cout << " event begin" << endl;
-        e->trigger();
-        // cout << " event end" << endl;
-        delete e;
-        e = event::get_next_event();
     }
     // cout << "no more event" << endl;
+    if (CHECKPOINT_AT != SIM_TIME_MAX && !watchdog::aborted())
+    {
+        // the run ended before CHECKPOINT_AT, so the final state is saved
+        if (e != nullptr)
+            events.push(e);
+        CHECKPOINT_AT = SIM_TIME_MAX;
+        checkpoint::save(CHECKPOINT_FILE);
+    }
+    if (PROGRESS_INTERVAL != 0)
+        print_progress(true);
+    profiler::active = false;
+    replay_log::close();
+    trace_writer::close();
+    sim_stats::dump(cur_time, true);
+    profiler::print();
+}
+
+// a line on stderr if PROGRESS_INTERVAL seconds have passed since the last one; the final line is always printed
+// the events per second are those since the last line; the eta assumes the simulated time keeps its average rate
+void event::print_progress(bool final)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double since_last = chrono::duration<double>(now - progress_last).count();
+    if (!final && since_last < PROGRESS_INTERVAL)
+        return;
+    double elapsed = chrono::duration<double>(now - progress_begin).count();
+    double rate = since_last > 0 ? (processed - progress_last_events) / since_last : 0;
+    cerr << "progress: time " << time_to_string(cur_time) << "/" << time_to_string(end_time);
+    if (end_time != 0)
+        cerr << " (" << fixed << setprecision(1) << 100. * cur_time / end_time << "%)" << defaultfloat;
+    cerr << ", " << (unsigned long long)rate << " events/s, " << events.size() << " pending, " << packet::getLivePacketNum()
+         << " live packets, " << processed << " events";
+    if (final)
+        cerr << ", done in " << setprecision(3) << elapsed << "s" << endl;
+    else if (cur_time > 0 && cur_time < end_time)
+    {
+        unsigned long long eta = (unsigned long long)(elapsed * (double)(end_time - cur_time) / cur_time);
+        cerr << ", eta " << eta / 3600 << ":" << setfill('0') << setw(2) << eta / 60 % 60 << ":" << setw(2) << eta % 60
+             << setfill(' ') << endl;
+    }
+    else
+        cerr << endl;
+    progress_last = now;
+    progress_last_events = processed;
 }
 
 bool mycomp::operator()(const event *lhs, const event *rhs) const
@@ -1263,7 +3124,7 @@ private:
 
 protected:
     // this constructor cannot be directly called by users; only by generator
-    recv_event(unsigned int _trigger_time, void *data) : event(_trigger_time), senderID(BROCAST_ID), receiverID(BROCAST_ID), pkt(nullptr)
+    recv_event(sim_time _trigger_time, void *data) : event(_trigger_time), senderID(BROCAST_ID), receiverID(BROCAST_ID), pkt(nullptr)
     {
         recv_data *data_ptr = (recv_data *)data;
         senderID = data_ptr->s_id;
@@ -1275,6 +3136,16 @@ public:
     virtual ~recv_event() {}
     // recv_event will trigger the recv function
     virtual void trigger();
+    GET(getPacket, packet *, pkt);
+    GET(getSenderID, unsigned int, senderID);
+    GET(getReceiverID, unsigned int, receiverID);
+    string type() const { return "recv_event"; }
+    bool to_record(trace_record &r) const;
+    void save(checkpoint_out &out) const
+    {
+        out.put(senderID), out.put(receiverID);
+        packet::save(out, pkt);
+    }
 
     unsigned int event_priority() const;
 
@@ -1291,11 +3162,18 @@ public:
         }
 
     protected:
-        virtual event *generate(unsigned int _trigger_time, void *data)
+        virtual event *generate(sim_time _trigger_time, void *data)
         {
             // cout << "recv_event generated" << endl;
             return new recv_event(_trigger_time, data);
         }
+        virtual event *load(sim_time _trigger_time, checkpoint_in &in)
+        {
+            recv_data data;
+            in.get(data.s_id), in.get(data.r_id);
+            data._pkt = packet::load(in);
+            return in.failed() ? nullptr : new recv_event(_trigger_time, (void *)&data);
+        }
 
     public:
         virtual string type() { return "recv_event"; }
@@ -1319,11 +3197,14 @@ void recv_event::trigger()
     if (pkt == nullptr)
     {
         cerr << "recv_event error: no pkt!" << endl;
+        flight_recorder::dump("recv_event without a packet");
         return;
     }
     else if (node::id_to_node(receiverID) == nullptr)
     {
         cerr << "recv_event error: no node " << receiverID << "!" << endl;
+        flight_recorder::dump("recv_event to a missing node");
+        sim_stats::record_drop(pkt, "missing node", receiverID);
         delete pkt;
         return;
     }
@@ -1332,20 +3213,25 @@ void recv_event::trigger()
 unsigned int recv_event::event_priority() const
 {
     string string_for_hash;
-    string_for_hash = to_string(getTriggerTime()) + to_string(senderID) + to_string(receiverID) + to_string(pkt->getPacketID());
+    string_for_hash = time_to_string(getTriggerTime()) + to_string(senderID) + to_string(receiverID) + to_string(pkt->getPacketID());
     return get_hash_value(string_for_hash);
 }
+bool recv_event::to_record(trace_record &r) const
+{
+    if (pkt == nullptr)
+        return false;
+    trace_record_set(r, event::getCurTime(), TRACE_RECV, receiverID, pkt->getPacketID(), pkt->getHeader()->getSrcID(),
+                     pkt->getHeader()->getDstID(), pkt->getHeader()->getPreID(), pkt->getHeader()->getNexID());
+    return true;
+}
 // the recv_event::print() function is used for log file
 void recv_event::print() const
 {
-    cout << "time " << setw(11) << event::getCurTime()
-         << "   recID " << setw(11) << receiverID
-         << "   pktID" << setw(11) << pkt->getPacketID()
-         << "   srcID " << setw(11) << pkt->getHeader()->getSrcID()
-         << "   dstID" << setw(11) << pkt->getHeader()->getDstID()
-         << "   preID" << setw(11) << pkt->getHeader()->getPreID()
-         << "   nexID" << setw(11) << pkt->getHeader()->getNexID()
-         << endl;
+    if (!trace_writer::accept(pkt))
+        return;
+    trace_writer::write_event(event::getCurTime(), "recID", receiverID, pkt->getPacketID(),
+                              pkt->getHeader()->getSrcID(), pkt->getHeader()->getDstID(),
+                              pkt->getHeader()->getPreID(), pkt->getHeader()->getNexID());
 }
 
 class send_event : public event
@@ -1362,7 +3248,7 @@ private:
     packet *pkt;             // the packet
 
 protected:
-    send_event(unsigned int _trigger_time, void *data) : event(_trigger_time), senderID(BROCAST_ID), receiverID(BROCAST_ID), pkt(nullptr)
+    send_event(sim_time _trigger_time, void *data) : event(_trigger_time), senderID(BROCAST_ID), receiverID(BROCAST_ID), pkt(nullptr)
     {
         send_data *data_ptr = (send_data *)data;
         senderID = data_ptr->s_id;
@@ -1374,6 +3260,16 @@ public:
     virtual ~send_event() {}
     // send_event will trigger the send function
     virtual void trigger();
+    GET(getPacket, packet *, pkt);
+    GET(getSenderID, unsigned int, senderID);
+    GET(getReceiverID, unsigned int, receiverID);
+    string type() const { return "send_event"; }
+    bool to_record(trace_record &r) const;
+    void save(checkpoint_out &out) const
+    {
+        out.put(senderID), out.put(receiverID);
+        packet::save(out, pkt);
+    }
 
     unsigned int event_priority() const;
 
@@ -1390,11 +3286,18 @@ public:
         }
 
     protected:
-        virtual event *generate(unsigned int _trigger_time, void *data)
+        virtual event *generate(sim_time _trigger_time, void *data)
         {
             // cout << "send_event generated" << endl;
             return new send_event(_trigger_time, data);
         }
+        virtual event *load(sim_time _trigger_time, checkpoint_in &in)
+        {
+            send_data data;
+            in.get(data.s_id), in.get(data.r_id);
+            data._pkt = packet::load(in);
+            return in.failed() ? nullptr : new send_event(_trigger_time, (void *)&data);
+        }
 
     public:
         virtual string type() { return "send_event"; }
@@ -1418,11 +3321,14 @@ void send_event::trigger()
     if (pkt == nullptr)
     {
         cerr << "send_event error: no pkt!" << endl;
+        flight_recorder::dump("send_event without a packet");
         return;
     }
     else if (node::id_to_node(senderID) == nullptr)
     {
         cerr << "send_event error: no node " << senderID << "!" << endl;
+        flight_recorder::dump("send_event from a missing node");
+        sim_stats::record_drop(pkt, "missing node", senderID);
         delete pkt;
         return;
     }
@@ -1431,22 +3337,211 @@ void send_event::trigger()
 unsigned int send_event::event_priority() const
 {
     string string_for_hash;
-    string_for_hash = to_string(getTriggerTime()) + to_string(senderID) + to_string(receiverID) + to_string(pkt->getPacketID());
+    string_for_hash = time_to_string(getTriggerTime()) + to_string(senderID) + to_string(receiverID) + to_string(pkt->getPacketID());
     return get_hash_value(string_for_hash);
 }
+bool send_event::to_record(trace_record &r) const
+{
+    if (pkt == nullptr)
+        return false;
+    trace_record_set(r, event::getCurTime(), TRACE_SEND, senderID, pkt->getPacketID(), pkt->getHeader()->getSrcID(),
+                     pkt->getHeader()->getDstID(), pkt->getHeader()->getPreID(), pkt->getHeader()->getNexID());
+    return true;
+}
 // the send_event::print() function is used for log file
 void send_event::print() const
 {
-    cout << "time " << setw(11) << event::getCurTime()
-         << "   senID " << setw(11) << senderID
-         << "   pktID" << setw(11) << pkt->getPacketID()
-         << "   srcID " << setw(11) << pkt->getHeader()->getSrcID()
-         << "   dstID" << setw(11) << pkt->getHeader()->getDstID()
-         << "   preID" << setw(11) << pkt->getHeader()->getPreID()
-         << "   nexID" << setw(11) << pkt->getHeader()->getNexID()
-         //<< "   type: " << setw(11) << pkt->type()
-         //<< "   msg"         << setw(11) << dynamic_cast<GR_payload*>(pkt->getPayload())->getMsg()
-         << endl;
+    if (!trace_writer::accept(pkt))
+        return;
+    trace_writer::write_event(event::getCurTime(), "senID", senderID, pkt->getPacketID(),
+                              pkt->getHeader()->getSrcID(), pkt->getHeader()->getDstID(),
+                              pkt->getHeader()->getPreID(), pkt->getHeader()->getNexID());
+    //<< "   type: " << setw(11) << pkt->type()
+    //<< "   msg"         << setw(11) << dynamic_cast<GR_payload*>(pkt->getPayload())->getMsg()
+}
+
+// the event of a node timer (see node::schedule_timer). Cancelling or rescheduling a timer bumps the
+// generation of its slot instead of searching the queue, so the events of the older generations become
+// cancelled() and are deleted untriggered. A timer rescheduled by its own handler reuses its event
+class timer_event : public event
+{
+public:
+    class timer_data; // forward declaration
+
+private:
+    timer_event(timer_event &) {} // this constructor cannot be used
+    timer_event() {}              // we don't allow users to new a timer_event by themselve
+    unsigned int nodeID;          // the node owning the timer
+    unsigned int timer;           // the id of the timer at the node
+    unsigned int generation;      // the generation of the timer this event belongs to
+    node *owner;
+    bool requeued_flag;           // the handler rescheduled the timer and this event went back into the queue
+    static timer_event *firing;   // the event being triggered
+
+protected:
+    // this constructor cannot be directly called by users; only by generator
+    timer_event(sim_time _trigger_time, void *data) : event(_trigger_time), requeued_flag(false)
+    {
+        timer_data *data_ptr = (timer_data *)data;
+        nodeID = data_ptr->n_id;
+        timer = data_ptr->timer;
+        generation = data_ptr->generation;
+        owner = node::id_to_node(nodeID);
+    }
+
+public:
+    virtual ~timer_event() {}
+    // timer_event calls the timer_handler of the node unless it is cancelled
+    virtual void trigger();
+    GET(getSenderID, unsigned int, nodeID);
+    GET(getReceiverID, unsigned int, nodeID);
+    GET(getEventID, unsigned int, timer); // two timers of a node may fire at the same time
+    string type() const { return "timer_event"; }
+    bool cancelled() const { return owner == nullptr || !owner->timer_current(timer, generation); }
+    bool requeued() const { return requeued_flag; }
+    void save(checkpoint_out &out) const { out.put(nodeID), out.put(timer), out.put(generation); }
+    // add the event of a timer armed at time t; the event being triggered is reused if it is the timer's
+    static void arm(node *n, unsigned int _timer, unsigned int _generation, sim_time t);
+
+    unsigned int event_priority() const;
+
+    class timer_event_generator;
+    friend class timer_event_generator;
+    // timer_event is derived from event_generator to generate a event
+    class timer_event_generator : public event_generator
+    {
+        static timer_event_generator sample;
+        // this constructor is only for sample to register this event type
+        timer_event_generator() { register_event_type(&sample); }
+
+    protected:
+        virtual event *generate(sim_time _trigger_time, void *data) { return new timer_event(_trigger_time, data); }
+        virtual event *load(sim_time _trigger_time, checkpoint_in &in)
+        {
+            timer_data data;
+            in.get(data.n_id), in.get(data.timer), in.get(data.generation);
+            return in.failed() ? nullptr : new timer_event(_trigger_time, (void *)&data);
+        }
+
+    public:
+        virtual string type() { return "timer_event"; }
+        ~timer_event_generator() {}
+    };
+    // this class is used to initialize the timer_event
+    class timer_data
+    {
+    public:
+        unsigned int n_id;
+        unsigned int timer;
+        unsigned int generation;
+    };
+
+    void print() const {} // a timer is not a packet, so it is not in the event log
+};
+timer_event::timer_event_generator timer_event::timer_event_generator::sample;
+timer_event *timer_event::firing = nullptr;
+
+void timer_event::trigger()
+{
+    requeued_flag = false;
+    if (cancelled())
+    {
+        // it was cancelled after it was taken out of the queue
+        event::uncount_cancelled();
+        return;
+    }
+    firing = this;
+    owner->fire_timer(timer);
+    firing = nullptr;
+}
+void timer_event::arm(node *n, unsigned int _timer, unsigned int _generation, sim_time t)
+{
+    if (firing != nullptr && firing->owner == n && firing->timer == _timer && !firing->requeued_flag)
+    {
+        firing->setTriggerTime(t);
+        firing->generation = _generation;
+        firing->requeued_flag = true;
+        add_event(firing);
+        return;
+    }
+    timer_data data;
+    data.n_id = n->getNodeID();
+    data.timer = _timer;
+    data.generation = _generation;
+    event::event_generator::generate("timer_event", t, (void *)&data);
+}
+unsigned int timer_event::event_priority() const
+{
+    string string_for_hash;
+    string_for_hash = time_to_string(getTriggerTime()) + "timer" + to_string(nodeID) + "#" + to_string(timer);
+    return get_hash_value(string_for_hash);
+}
+
+unsigned int node::schedule_timer(sim_time delay, unsigned int kind, unsigned int data)
+{
+    unsigned int timer;
+    if (free_timers.empty())
+    {
+        timer = timers.size();
+        timers.push_back(timer_slot());
+        timers.back().generation = 0;
+    }
+    else
+    {
+        timer = free_timers.back();
+        free_timers.pop_back();
+    }
+    timer_slot &s = timers[timer];
+    s.kind = kind;
+    s.data = data;
+    s.in_use = true;
+    s.armed = false;
+    arm_timer(timer, delay);
+    return timer;
+}
+bool node::cancel_timer(unsigned int timer)
+{
+    if (timer >= timers.size() || !timers[timer].in_use)
+        return false;
+    timer_slot &s = timers[timer];
+    bool was_armed = s.armed;
+    s.generation++;
+    s.armed = false;
+    s.in_use = false;
+    free_timers.push_back(timer);
+    if (was_armed)
+        event::count_cancelled(); // after the generation changed, so a purge deletes its event
+    return true;
+}
+bool node::reschedule_timer(unsigned int timer, sim_time delay)
+{
+    if (timer >= timers.size() || !timers[timer].in_use)
+        return false;
+    arm_timer(timer, delay);
+    return true;
+}
+void node::arm_timer(unsigned int timer, sim_time delay)
+{
+    timer_slot &s = timers[timer];
+    bool was_armed = s.armed;
+    s.generation++;
+    s.armed = true;
+    timer_event::arm(this, timer, s.generation, event::getCurTime() + delay);
+    if (was_armed)
+        event::count_cancelled(); // its pending event is now stale
+
+}
+void node::fire_timer(unsigned int timer)
+{
+    timers[timer].armed = false;
+    timer_handler(timer, timers[timer].kind, timers[timer].data);
+    // the handler may have added timers, so the slot is looked up again
+    if (timers[timer].in_use && !timers[timer].armed)
+    {
+        timers[timer].in_use = false;
+        timers[timer].generation++;
+        free_timers.push_back(timer);
+    }
 }
 
 class link
@@ -1533,7 +3628,7 @@ public:
     };
 };
 map<string, link::link_generator *> link::link_generator::prototypes;
-map<pair<unsigned int, unsigned int>, link *> link::id_id_link_table;
+map<pair<unsigned int, unsigned int>, class link *> link::id_id_link_table; // <csignal> also declares a function named link
 
 void node::add_phy_neighbor(unsigned int _id, string link_type)
 {
@@ -1547,6 +3642,39 @@ void node::add_phy_neighbor(unsigned int _id, string link_type)
 
     link::link_generator::generate(link_type, id, _id);
 }
+void node::saveState(checkpoint_out &out)
+{
+    out.put((uint64_t)id_node_table.size());
+    for (map<unsigned int, node *>::iterator it = id_node_table.begin(); it != id_node_table.end(); it++)
+        out.put(it->first), out.put(it->second->type());
+    for (map<unsigned int, node *>::iterator it = id_node_table.begin(); it != id_node_table.end(); it++)
+        it->second->save(out);
+}
+void node::loadState(checkpoint_in &in)
+{
+    uint64_t num = 0;
+    vector<unsigned int> ids;
+    in.get(num);
+    for (uint64_t i = 0; i < num && !in.failed(); i++)
+    {
+        unsigned int _id = 0;
+        string type;
+        in.get(_id), in.get(type);
+        if (in.failed() || node_generator::generate(type, _id) == nullptr)
+            in.fail();
+        else
+            ids.push_back(_id);
+    }
+    for (size_t i = 0; i < ids.size() && !in.failed(); i++)
+        id_node_table[ids[i]]->load(in);
+}
+void node::load(checkpoint_in &in)
+{
+    map<unsigned int, bool> neighbors;
+    in.get(neighbors), in.get(timers), in.get(free_timers);
+    for (map<unsigned int, bool>::iterator it = neighbors.begin(); it != neighbors.end(); it++)
+        add_phy_neighbor(it->first); // every link is a simple_link
+}
 void node::del_phy_neighbor(unsigned int _id)
 {
     phy_neighbors.erase(_id);
@@ -1595,13 +3723,37 @@ class GR_node : public node
     double y;
     map<unsigned int, bool> one_hop_neighbors; // you can use this variable to record the node's 1-hop neighbors
     map<unsigned int, pair<double, double>> coord_table;//ccu
+    map<unsigned int, bool> path_cached; // entries of coord_table learned from forwarded packets
+    unsigned int home_records;           // the number of Rep_packets this node has stored as a home node
     list<GR_packet*> GR_wait;
+    // the lookup timer of a GR_packet in GR_wait, with LOOKUP_TIMEOUT
+    class lookup_wait
+    {
+    public:
+        unsigned int timer;
+        unsigned int tries; // the Ret_packets sent again
+    };
+    map<unsigned int, lookup_wait> lookup_waits; // the pktID of the waiting GR_packet -> its timer
+    // with HELLO_INTERVAL, the HELLOs are sent by a timer which reschedules itself, so a beacon costs no new event
+    // besides its packet's; the neighbors are expired at the node's own beacons, not by a timer per neighbor
+    map<unsigned int, sim_time> neighbor_heard; // neighbor -> when its last HELLO arrived (with NEIGHBOR_TIMEOUT)
+    unsigned int beacon_timer;
+    bool beaconing;
+    unsigned int beacons; // the HELLOs sent so far; it also seeds the jitter of the next interval
     bool hi; // this is used for example
+    // cache the position of n_id carried by a forwarded packet (only in PATH_CACHE mode)
+    void cache_on_path(unsigned int n_id, double _x, double _y);
+    // send a Ret_packet to the nearest home point of the destination of waiting, a GR_packet in GR_wait
+    void send_lookup(GR_packet *waiting);
+    // the time until the next HELLO: HELLO_INTERVAL with a jitter drawn from the node id and beacons
+    sim_time hello_interval() const;
+    // forget the neighbors not heard from for NEIGHBOR_TIMEOUT, then broadcast a HELLO with the position
+    void send_beacon();
 
 protected:
     GR_node() {}                                        // it should not be used
     GR_node(GR_node &) {}                               // it should not be used
-    GR_node(unsigned int _id) : node(_id), hi(false) {} // this constructor cannot be directly called by users
+    GR_node(unsigned int _id) : node(_id), home_records(0), beacon_timer(0), beaconing(false), beacons(0), hi(false) {} // this constructor cannot be directly called by users
 
 public:
     ~GR_node() {}
@@ -1613,12 +3765,71 @@ public:
 
     // please define recv_handler function to deal with the incoming packet
     virtual void recv_handler(packet *p);
+    // the kinds of the timers of GR_node
+    static const unsigned int LOOKUP_TIMER = 0; // the data is the pktID of the GR_packet waiting for the lookup
+    static const unsigned int BEACON_TIMER = 1; // the periodic HELLO
+    virtual void timer_handler(unsigned int timer, unsigned int kind, unsigned int data);
+
+    string type() const { return "GR_node"; }
+    void save(checkpoint_out &out) const;
+    void load(checkpoint_in &in);
+    // the lookup log and the cache statistics, for a checkpoint
+    static void saveState(checkpoint_out &out)
+    {
+        out.put(lookup_log), out.put(cache_hits), out.put(cache_misses), out.put(saved_hops);
+        out.put(lookup_retried), out.put(lookup_expired), out.put(beacons_sent), out.put(neighbors_expired);
+    }
+    static void loadState(checkpoint_in &in)
+    {
+        in.get(lookup_log), in.get(cache_hits), in.get(cache_misses), in.get(saved_hops);
+        in.get(lookup_retried), in.get(lookup_expired), in.get(beacons_sent), in.get(neighbors_expired);
+    }
+
+    // the neighbor closest to (_x, _y); it returns the id of this node if no neighbor is closer
+    unsigned int greedy_next(double _x, double _y);
+    // the next hop of packet header h heading to (_x, _y); in PERIMETER mode, it falls back to
+    // GPSR perimeter routing on the Gabriel graph when greedy forwarding reaches a local minimum
+    // it returns the id of this node if the packet cannot go further
+    unsigned int next_hop(header *h, double _x, double _y);
+    // the neighbors which are kept in the Gabriel graph (a planar subgraph of one_hop_neighbors)
+    vector<unsigned int> planar_neighbors();
+    // the first planar neighbor counterclockwise from the direction angle around this node
+    unsigned int right_hand_next(const vector<unsigned int> &planar, double angle);
 
     void add_one_hop_neighbor(unsigned int n_id) { one_hop_neighbors[n_id] = true; }
     unsigned int get_one_hop_neighbor_num() { return one_hop_neighbors.size(); }
     void add_coord_table(unsigned int n_id, double x, double y) { coord_table[n_id].first = x; coord_table[n_id].second = y; }
     unsigned int get_coord_table_num() { return coord_table.size(); }//ccu
-    
+    // store the position of a publishing node n_id as its home node
+    void add_home_record(unsigned int n_id, double x, double y) { add_coord_table(n_id, x, y); home_records++; }
+    GET(get_home_record_num, unsigned int, home_records);
+    static void print_home_records();
+
+    // the result of a location lookup, i.e., a Ret_packet and Res_packet round trip
+    class lookup_record
+    {
+    public:
+        unsigned int pktID;  // the GR_packet waiting for the lookup
+        unsigned int dstID;  // the node being looked up
+        unsigned int homeID; // the home node answering the lookup
+        unsigned int hops;   // hops of the Ret_packet plus hops of the Res_packet
+    };
+    static vector<lookup_record> lookup_log;
+    static void print_lookup_log();
+
+    // statistics of the on-path cache, counted at the sources of GR_packets
+    static unsigned int cache_hits;         // lookups avoided by a cached position
+    static unsigned int cache_misses;       // lookups sent as Ret_packets
+    static unsigned long long saved_hops;   // estimated Ret_packet and Res_packet hops avoided
+    static void print_cache_stats();
+    // the lookups which timed out: sent again, or given up with their GR_packets dropped
+    static unsigned long long lookup_retried;
+    static unsigned long long lookup_expired;
+    // the periodic HELLOs sent and the neighbors forgotten
+    static unsigned long long beacons_sent;
+    static unsigned long long neighbors_expired;
+    static void print_hello_stats();
+
     class GR_node_generator;
     friend class GR_node_generator;
     // GR_node is derived from node_generator to generate a node
@@ -1643,12 +3854,129 @@ public:
     };
 };
 GR_node::GR_node_generator GR_node::GR_node_generator::sample;
+vector<GR_node::lookup_record> GR_node::lookup_log;
+
+void GR_node::save(checkpoint_out &out) const
+{
+    node::save(out);
+    out.put(x), out.put(y), out.put(one_hop_neighbors), out.put(coord_table), out.put(path_cached);
+    out.put(home_records), out.put(hi), out.put(lookup_waits);
+    out.put(neighbor_heard), out.put(beacon_timer), out.put(beaconing), out.put(beacons);
+    out.put((uint64_t)GR_wait.size());
+    for (list<GR_packet *>::const_iterator it = GR_wait.begin(); it != GR_wait.end(); it++)
+        packet::save(out, *it);
+}
+void GR_node::load(checkpoint_in &in)
+{
+    node::load(in);
+    in.get(x), in.get(y), in.get(one_hop_neighbors), in.get(coord_table), in.get(path_cached);
+    in.get(home_records), in.get(hi), in.get(lookup_waits);
+    in.get(neighbor_heard), in.get(beacon_timer), in.get(beaconing), in.get(beacons);
+    uint64_t num = 0;
+    in.get(num);
+    for (uint64_t i = 0; i < num && !in.failed(); i++)
+    {
+        packet *p = packet::load(in);
+        if (dynamic_cast<GR_packet *>(p) != nullptr)
+            GR_wait.push_back(dynamic_cast<GR_packet *>(p));
+        else
+        {
+            packet::discard(p);
+            in.fail();
+        }
+    }
+}
+unsigned int GR_node::cache_hits = 0;
+unsigned int GR_node::cache_misses = 0;
+unsigned long long GR_node::saved_hops = 0;
+unsigned long long GR_node::lookup_retried = 0;
+unsigned long long GR_node::lookup_expired = 0;
+unsigned long long GR_node::beacons_sent = 0;
+unsigned long long GR_node::neighbors_expired = 0;
+
+void GR_node::print_home_records()
+{
+    unsigned int nodeNum = node::getNodeNum(), homes = 0, max = 0, max_id = BROCAST_ID;
+    unsigned long long total = 0, square = 0;
+    for (unsigned int id = 0; id < nodeNum; id++)
+    {
+        GR_node *n = dynamic_cast<GR_node *>(node::id_to_node(id));
+        if (n == nullptr || n->home_records == 0)
+            continue;
+        cerr << "home " << setw(11) << id << "   records " << setw(11) << n->home_records << endl;
+        homes++;
+        total += n->home_records;
+        square += (unsigned long long)n->home_records * n->home_records;
+        if (n->home_records > max)
+        {
+            max = n->home_records;
+            max_id = id;
+        }
+    }
+    double mean = nodeNum == 0 ? 0. : (double)total / nodeNum;
+    cerr << "records " << total << "   home nodes " << homes << "/" << nodeNum
+         << "   mean " << mean << "   stddev " << (nodeNum == 0 ? 0. : sqrt((double)square / nodeNum - mean * mean))
+         << "   max " << max << " (node " << max_id << ")" << endl;
+}
+
+void GR_node::print_cache_stats()
+{
+    unsigned int lookups = cache_hits + cache_misses;
+    cerr << "path cache hits " << cache_hits << "   misses " << cache_misses
+         << "   hit rate " << (lookups == 0 ? 0. : (double)cache_hits / lookups)
+         << "   saved hops " << saved_hops << endl;
+}
+
+void GR_node::print_hello_stats()
+{
+    unsigned long long neighbors = 0;
+    unsigned int nodes = node::getNodeNum();
+    for (unsigned int id = 0; id < nodes; id++)
+        if (GR_node *n = dynamic_cast<GR_node *>(node::id_to_node(id)))
+            neighbors += n->get_one_hop_neighbor_num();
+    cerr << "hello beacons " << beacons_sent << "   neighbors expired " << neighbors_expired
+         << "   avg neighbors " << (nodes == 0 ? 0. : (double)neighbors / nodes) << endl;
+}
+
+void GR_node::print_lookup_log()
+{
+    unsigned long long total = 0;
+    for (vector<lookup_record>::iterator it = lookup_log.begin(); it != lookup_log.end(); it++)
+    {
+        cerr << "lookup pktID " << setw(11) << it->pktID
+             << "   dstID " << setw(11) << it->dstID
+             << "   homeID " << setw(11) << it->homeID
+             << "   hops " << setw(6) << it->hops << endl;
+        total += it->hops;
+    }
+    cerr << "lookups " << lookup_log.size() << "   replicas " << REP_NUM << "   avg hops "
+         << (lookup_log.empty() ? 0. : (double)total / lookup_log.size()) << endl;
+    if (LOOKUP_TIMEOUT != 0)
+        cerr << "lookup timeouts: " << lookup_retried << " sent again, " << lookup_expired << " given up" << endl;
+}
+
+// the finalizer of splitmix64; every input bit affects every output bit
+unsigned long long splitmix64(unsigned long long v)
+{
+    v += 0x9e3779b97f4a7c15ULL;
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+    return v ^ (v >> 31);
+}
 
-pair<unsigned int, unsigned int> myHash(unsigned int id){//ccu
-    pair<unsigned int, unsigned int> c;
+// the replica-th home point of id; the 0-th one is the original single home point
+pair<double, double> myHash(unsigned int id, unsigned int replica = 0){//ccu
+    pair<double, double> c;
+    if (MIX_HASH){
+        // X_MAX and Y_MAX are given in 1/10000 of the coordinate unit
+        unsigned long long v = splitmix64(((unsigned long long)replica << 32) | id);
+        c.first = (splitmix64(v) >> 11) * 0x1.0p-53 * (X_MAX / 10000.);
+        c.second = (splitmix64(v ^ 0x5851f42d4c957f2dULL) >> 11) * 0x1.0p-53 * (Y_MAX / 10000.);
+        return c;
+    }
     unsigned int v1, v2;
     hash<string> coord;
-    v1 = coord(to_string(id));
+    v1 = (replica == 0) ? coord(to_string(id)) : coord(to_string(id) + "#" + to_string(replica));
     v2 = coord(to_string(v1));
     c.first = (v1 % X_MAX) / 10000;
     c.second = (v2 % Y_MAX) / 10000;
@@ -1656,7 +3984,7 @@ pair<unsigned int, unsigned int> myHash(unsigned int id){//ccu
     return c;
 }
 
-// the function is used to add an initial event
+// the function is used to add an initial event; t is in whole ticks, as in the scenario
 void add_initial_event(unsigned int src, unsigned int dst, unsigned t = 0, string msg = "default")
 {
     if (node::id_to_node(src) == nullptr || (dst != BROCAST_ID && node::id_to_node(dst) == nullptr))
@@ -1720,7 +4048,7 @@ void add_initial_event(unsigned int src, unsigned int dst, unsigned t = 0, strin
         //     hdr->mark_visited_node(i);
         // }
 
-        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", t, (void *)&e_data));
+        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", ticks_to_time(t), (void *)&e_data));
         if (e == nullptr)
             cerr << "event type is incorrect" << endl;
     }
@@ -1765,7 +4093,7 @@ void add_initial_event(unsigned int src, unsigned int dst, unsigned t = 0, strin
         //     hdr->mark_visited_node(i);
         // }
 
-        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", t, (void *)&e_data));
+        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", ticks_to_time(t), (void *)&e_data));
         if (e == nullptr)
             cerr << "event type is incorrect" << endl;
     }
@@ -1795,6 +4123,7 @@ void add_initial_event(unsigned int src, unsigned int dst, unsigned t = 0, strin
         hdr->setDstID(dst);
         hdr->setPreID(src);
         hdr->setNexID(src);
+        hdr->setStartTime(ticks_to_time(t));
 
         pld->setMsg(msg);
 
@@ -1810,7 +4139,7 @@ void add_initial_event(unsigned int src, unsigned int dst, unsigned t = 0, strin
         //     hdr->mark_visited_node(i);
         // }
 
-        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", t, (void *)&e_data));
+        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", ticks_to_time(t), (void *)&e_data));
         if (e == nullptr)
             cerr << "event type is incorrect" << endl;
     }
@@ -1848,62 +4177,384 @@ pair<double, double> getNodePos(unsigned int id)
     return pair<double, double>(ptr->getX(), ptr->getY());
 }
 
-// send_handler function is used to transmit packet p based on the information in the header
-// Note that the packet p will not be discard after send_handler ()
+// send_handler function is used to transmit packet p based on the information in the header
+// Note that the packet p will not be discard after send_handler ()
+
+void node::send_handler(packet *p)
+{
+    profile_scope scope("send_handler");
+    send_owned(packet::packet_generator::replicate(p));
+}
+
+void node::send_owned(packet *p)
+{
+    if (p->getHeader()->getSrcID() != id)
+        sim_stats::record_forward(p, id);
+    send_event::send_data e_data;
+    e_data.s_id = p->getHeader()->getPreID();
+    e_data.r_id = p->getHeader()->getNexID();
+    e_data._pkt = p;
+    send_event *e = dynamic_cast<send_event *>(event::event_generator::generate("send_event", event::getCurTime(), (void *)&e_data));
+    if (e == nullptr)
+        cerr << "event type is incorrect" << endl;
+}
+
+void node::send(packet *p)
+{ // this function is called by event; not for the user
+    if (p == nullptr)
+        return;
+    profile_scope scope("node::send");
+
+    unsigned int _nexID = p->getHeader()->getNexID();
+    if (p->getHeader()->getHopNum() >= p->getHeader()->getTTL())
+    {
+        sim_stats::record_drop(p, "TTL", id);
+        packet::discard(p);
+        return;
+    }
+    if (!watchdog::admit(p))
+    {
+        sim_stats::record_drop(p, "storm", id);
+        watchdog::count_drop();
+        packet::discard(p);
+        return;
+    }
+    if (BROCAST_ID != _nexID && phy_neighbors.find(_nexID) == phy_neighbors.end())
+        sim_stats::record_drop(p, (_nexID == id) ? "local minimum" : "no link", id);
+    else
+        sim_stats::record_send(p, id);
+    // every receiver but the last one gets a copy; the last one gets p itself
+    map<unsigned int, bool>::iterator last = phy_neighbors.end();
+    for (map<unsigned int, bool>::iterator it = phy_neighbors.begin(); it != phy_neighbors.end(); it++)
+    {
+        unsigned int nb_id = it->first; // neighbor id
+
+        if (nb_id != _nexID && BROCAST_ID != _nexID)
+            continue; // this neighbor will not receive the packet
+        if (last != phy_neighbors.end())
+            deliver(last->first, packet::packet_generator::replicate(p));
+        last = it;
+    }
+    if (last != phy_neighbors.end())
+        deliver(last->first, p);
+    else
+        packet::discard(p);
+}
+
+// schedule the arrival of p at neighbor nb_id; the recv_event owns p
+void node::deliver(unsigned int nb_id, packet *p)
+{
+    sim_time trigger_time = event::getCurTime() + latency_to_time(link::id_id_to_link(id, nb_id)->getLatency()); // we simply assume that the delay is fixed
+    //cout << "node " << id << " send to node " << nb_id << " " << p->type() << endl;
+    recv_event::recv_data e_data;
+    e_data.s_id = id;
+    e_data.r_id = nb_id;
+
+    p->getHeader()->setHopNum(p->getHeader()->getHopNum() + 1);
+    e_data._pkt = p;
+
+    recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", trigger_time, (void *)&e_data)); // send the packet to the neighbor
+    if (e == nullptr)
+        cerr << "event type is incorrect" << endl;
+}
+
+double dst(unsigned int a, unsigned int b) {
+    pair<double, double> coordinate1;
+    pair<double, double> coordinate2;
+    coordinate1 = getNodePos(a);
+    coordinate2 = getNodePos(b);
+    return sqrt(pow((coordinate1.first - coordinate2.first), 2) + pow((coordinate1.second - coordinate2.second), 2));
+}
+
+double dst(unsigned int a, double x, double y) {
+    pair<double, double> coordinate1;
+    coordinate1 = getNodePos(a);
+    return sqrt(pow((coordinate1.first - x), 2) + pow((coordinate1.second - y), 2));
+}
+
+// among the REP_NUM home points of id, the one nearest to node cur
+pair<double, double> nearest_home(unsigned int id, unsigned int cur) {
+    pair<double, double> home = myHash(id);
+    double min = dst(cur, home.first, home.second);
+    for (unsigned int i = 1; i < REP_NUM; i++){
+        pair<double, double> h = myHash(id, i);
+        if (dst(cur, h.first, h.second) < min){
+            min = dst(cur, h.first, h.second);
+            home = h;
+        }
+    }
+    return home;
+}
+
+void GR_node::cache_on_path(unsigned int n_id, double _x, double _y)
+{
+    if (!PATH_CACHE || n_id == getNodeID() || coord_table.find(n_id) != coord_table.end())
+        return;
+    add_coord_table(n_id, _x, _y);
+    path_cached[n_id] = true;
+}
+
+vector<unsigned int> GR_node::planar_neighbors()
+{
+    vector<unsigned int> planar;
+    pair<double, double> u = getNodePos(getNodeID());
+    for (map<unsigned int, bool>::const_iterator v = one_hop_neighbors.begin(); v != one_hop_neighbors.end(); v++){
+        if (!v->second)
+            continue;
+        // the edge (u, v) is kept if no other neighbor w lies in the circle whose diameter is (u, v)
+        pair<double, double> pv = getNodePos(v->first);
+        double mx = (u.first + pv.first) / 2, my = (u.second + pv.second) / 2;
+        double r = dst(getNodeID(), mx, my);
+        bool keep = true;
+        for (map<unsigned int, bool>::const_iterator w = one_hop_neighbors.begin(); w != one_hop_neighbors.end() && keep; w++)
+            if (w->second && w->first != v->first && dst(w->first, mx, my) < r)
+                keep = false;
+        if (keep)
+            planar.push_back(v->first);
+    }
+    return planar;
+}
+
+unsigned int GR_node::right_hand_next(const vector<unsigned int> &planar, double angle)
+{
+    unsigned int NEXT = getNodeID();
+    double min = 4 * M_PI;
+    pair<double, double> u = getNodePos(getNodeID());
+    for (vector<unsigned int>::const_iterator v = planar.begin(); v != planar.end(); v++){
+        pair<double, double> pv = getNodePos(*v);
+        double delta = atan2(pv.second - u.second, pv.first - u.first) - angle;
+        while (delta <= 0)
+            delta += 2 * M_PI;
+        while (delta > 2 * M_PI)
+            delta -= 2 * M_PI;
+        if (delta < min){
+            min = delta;
+            NEXT = *v;
+        }
+    }
+    return NEXT;
+}
+
+// if segment (a, b) crosses segment (c, d), the crossing point is stored in (x, y)
+bool segment_cross(pair<double, double> a, pair<double, double> b, pair<double, double> c, pair<double, double> d, double &x, double &y)
+{
+    double rx = b.first - a.first, ry = b.second - a.second;
+    double sx = d.first - c.first, sy = d.second - c.second;
+    double denom = rx * sy - ry * sx;
+    if (denom == 0)
+        return false; // parallel
+    double t = ((c.first - a.first) * sy - (c.second - a.second) * sx) / denom;
+    double u = ((c.first - a.first) * ry - (c.second - a.second) * rx) / denom;
+    if (t < 0 || t > 1 || u < 0 || u > 1)
+        return false;
+    x = a.first + t * rx;
+    y = a.second + t * ry;
+    return true;
+}
+
+unsigned int GR_node::next_hop(header *h, double _x, double _y)
+{
+    unsigned int CUR = getNodeID();
+    if (!PERIMETER)
+        return greedy_next(_x, _y);
+
+    pair<double, double> cur = getNodePos(CUR);
+    pair<double, double> target(_x, _y);
+    double d = dst(CUR, _x, _y);
+    // back to greedy mode once the packet is closer than where it entered perimeter mode
+    if (h->getPeriMode() && d < sqrt(pow(h->getLpX() - _x, 2) + pow(h->getLpY() - _y, 2)))
+        h->setPeriMode(false);
+
+    if (!h->getPeriMode()){
+        unsigned int NEXT = greedy_next(_x, _y);
+        if (NEXT != CUR || d == 0)
+            return NEXT;
+        // a local minimum: enter perimeter mode and take the first edge counterclockwise from the line to the target
+        vector<unsigned int> planar = planar_neighbors();
+        NEXT = right_hand_next(planar, atan2(_y - cur.second, _x - cur.first));
+        if (NEXT == CUR)
+            return CUR;
+        h->setPeriMode(true);
+        h->setLpX(cur.first);
+        h->setLpY(cur.second);
+        h->setLfX(cur.first);
+        h->setLfY(cur.second);
+        h->setE0From(CUR);
+        h->setE0To(NEXT);
+        return NEXT;
+    }
+
+    // right-hand rule: the first edge counterclockwise from the edge the packet came from
+    vector<unsigned int> planar = planar_neighbors();
+    pair<double, double> pre = getNodePos(h->getPreID());
+    unsigned int NEXT = right_hand_next(planar, atan2(pre.second - cur.second, pre.first - cur.first));
+    if (NEXT == CUR)
+        return CUR;
+
+    // face change: the edge crosses the line from Lp to the target closer to the target than Lf
+    pair<double, double> lp(h->getLpX(), h->getLpY());
+    bool changed = false;
+    double ix, iy;
+    for (unsigned int i = 0; i < planar.size() && segment_cross(cur, getNodePos(NEXT), lp, target, ix, iy); i++){
+        double lf_d = sqrt(pow(h->getLfX() - _x, 2) + pow(h->getLfY() - _y, 2));
+        if (sqrt(pow(ix - _x, 2) + pow(iy - _y, 2)) >= lf_d - 1e-12)
+            break;
+        h->setLfX(ix);
+        h->setLfY(iy);
+        pair<double, double> nx = getNodePos(NEXT);
+        NEXT = right_hand_next(planar, atan2(nx.second - cur.second, nx.first - cur.first));
+        h->setE0From(CUR);
+        h->setE0To(NEXT);
+        changed = true;
+    }
+    // the packet has toured the whole face: this node is the closest one to the target it can reach
+    if (!changed && CUR == h->getE0From() && NEXT == h->getE0To())
+        return CUR;
+    return NEXT;
+}
+
+// the number of hops greedy routing takes from node from to the node closest to (x, y)
+unsigned int greedy_hops(unsigned int from, double x, double y)
+{
+    unsigned int hops = 0;
+    GR_node *cur = dynamic_cast<GR_node *>(node::id_to_node(from));
+    while (cur != nullptr && hops < node::getNodeNum())
+    {
+        unsigned int next = cur->greedy_next(x, y);
+        if (next == cur->getNodeID())
+            break;
+        cur = dynamic_cast<GR_node *>(node::id_to_node(next));
+        hops++;
+    }
+    return hops;
+}
+
+unsigned int GR_node::greedy_next(double _x, double _y)
+{
+    unsigned int NEXT = getNodeID();
+    double min = dst(getNodeID(), _x, _y);
+    for (map<unsigned int, bool>::const_iterator iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
+        if (iter->second && dst(iter->first, _x, _y) < min){
+            min = dst(iter->first, _x, _y);
+            NEXT = iter->first;
+        }
+    }
+    return NEXT;
+}
+
+void GR_node::send_lookup(GR_packet *waiting)
+{
+    unsigned int CUR = getNodeID();
+    unsigned int DST = waiting->getHeader()->getDstID();
+    unsigned int NEXT;
+    GR_header *GR_hdr = dynamic_cast<GR_header*>(waiting->getHeader());
+
+    Ret_packet *RET_pkt = dynamic_cast<Ret_packet *> (packet::packet_generator::generate("Ret_packet"));
+    Ret_header *RET_hdr = dynamic_cast<Ret_header *>(RET_pkt->getHeader());
+    Ret_payload *RET_pld = dynamic_cast<Ret_payload *>(RET_pkt->getPayload());
+
+    pair<double, double> hash; //ccu
+    hash = nearest_home(DST, CUR);//查詢最近的home point
+
+    RET_hdr->setDstX(hash.first);
+    RET_hdr->setDstY(hash.second);
+    RET_hdr->setSrcX(GR_hdr->getSrcX());
+    RET_hdr->setSrcY(GR_hdr->getSrcY());
+    RET_hdr->setcacheID(waiting->getPacketID());//紀錄暫存封包的ID
 
-void node::send_handler(packet *p)
-{
-    packet *_p = packet::packet_generator::replicate(p);
-    send_event::send_data e_data;
-    e_data.s_id = _p->getHeader()->getPreID();
-    e_data.r_id = _p->getHeader()->getNexID();
-    e_data._pkt = _p;
-    send_event *e = dynamic_cast<send_event *>(event::event_generator::generate("send_event", event::getCurTime(), (void *)&e_data));
-    if (e == nullptr)
-        cerr << "event type is incorrect" << endl;
-}
+    NEXT = next_hop(RET_hdr, hash.first, hash.second);
 
-void node::send(packet *p)
-{ // this function is called by event; not for the user
-    if (p == nullptr)
-        return;
+    RET_hdr->setSrcID(CUR);
+    RET_hdr->setDstID(BROCAST_ID);
+    RET_hdr->setPreID(CUR);
+    RET_hdr->setNexID(NEXT);
 
-    unsigned int _nexID = p->getHeader()->getNexID();
-    for (map<unsigned int, bool>::iterator it = phy_neighbors.begin(); it != phy_neighbors.end(); it++)
-    {
-        unsigned int nb_id = it->first; // neighbor id
+    RET_pld->setMsg(to_string(DST));
 
-        if (nb_id != _nexID && BROCAST_ID != _nexID)
-            continue; // this neighbor will not receive the packet
-        
-        unsigned int trigger_time = event::getCurTime() + link::id_id_to_link(id, nb_id)->getLatency(); // we simply assume that the delay is fixed
-        //cout << "node " << id << " send to node " << nb_id << " " << p->type() << endl;
-        recv_event::recv_data e_data;
-        e_data.s_id = id;
-        e_data.r_id = nb_id;
+    if(NEXT != CUR) send_handler(RET_pkt);
+    else sim_stats::record_drop(RET_pkt, "no record", CUR);//自己就是home node卻沒有資料
 
-        packet *p2 = packet::packet_generator::replicate(p);
-        e_data._pkt = p2;
+    packet *del = static_cast<packet*> (RET_pkt);
+    packet::discard(del);
+}
 
-        recv_event *e = dynamic_cast<recv_event *>(event::event_generator::generate("recv_event", trigger_time, (void *)&e_data)); // send the packet to the neighbor
-        if (e == nullptr)
-            cerr << "event type is incorrect" << endl;
+// a lookup timed out: its Ret_packet is sent again, or the GR_packet waiting for it is dropped;
+// a beacon timer sends the next HELLO
+void GR_node::timer_handler(unsigned int timer, unsigned int kind, unsigned int data)
+{
+    if (kind == BEACON_TIMER){
+        send_beacon();
+        sim_time interval = hello_interval();
+        if (interval == 0){
+            beaconing = false; // a zero delay would fire the timer forever at the same time
+            return;
+        }
+        reschedule_timer(timer, interval); // the event of this timer is reused
+        return;
+    }
+    if (kind != LOOKUP_TIMER)
+        return;
+    map<unsigned int, lookup_wait>::iterator w = lookup_waits.find(data);
+    list<GR_packet*>::iterator GR_it;
+    for(GR_it = GR_wait.begin(); GR_it != GR_wait.end(); GR_it++)
+        if((*GR_it)->getPacketID() == data)
+            break;
+    if (w == lookup_waits.end() || GR_it == GR_wait.end())
+        return;
+    if (w->second.tries < LOOKUP_RETRIES){
+        w->second.tries++;
+        lookup_retried++;
+        send_lookup(*GR_it);
+        reschedule_timer(timer, ticks_to_time(LOOKUP_TIMEOUT));
+        return;
     }
-    packet::discard(p);
+    lookup_waits.erase(w);
+    lookup_expired++;
+    GR_packet *GR_pkt = (*GR_it);
+    GR_wait.erase(GR_it);
+    sim_stats::record_drop(GR_pkt, "lookup timeout", getNodeID());
+    packet *del_pkt = static_cast<packet*> (GR_pkt);
+    packet::discard(del_pkt);
 }
 
-double dst(unsigned int a, unsigned int b) {
-    pair<double, double> coordinate1;
-    pair<double, double> coordinate2;
-    coordinate1 = getNodePos(a);
-    coordinate2 = getNodePos(b);
-    return sqrt(pow((coordinate1.first - coordinate2.first), 2) + pow((coordinate1.second - coordinate2.second), 2));
+sim_time GR_node::hello_interval() const
+{
+    sim_time interval = ticks_to_time(HELLO_INTERVAL);
+    if (HELLO_JITTER == 0)
+        return interval;
+    // uniform in [interval - jitter, interval + jitter], down to the resolution of the clock
+    sim_time jitter = ticks_to_time(HELLO_JITTER);
+    unsigned long long r = splitmix64(((unsigned long long)getNodeID() << 32) | beacons);
+    return interval - jitter + r % (2 * jitter + 1);
 }
 
-double dst(unsigned int a, double x, double y) {
-    pair<double, double> coordinate1;
-    coordinate1 = getNodePos(a);
-    return sqrt(pow((coordinate1.first - x), 2) + pow((coordinate1.second - y), 2));
+void GR_node::send_beacon()
+{
+    unsigned int CUR = getNodeID();
+    if (NEIGHBOR_TIMEOUT != 0){
+        sim_time now = event::getCurTime(), timeout = ticks_to_time(NEIGHBOR_TIMEOUT);
+        for (map<unsigned int, sim_time>::iterator it = neighbor_heard.begin(); it != neighbor_heard.end();){
+            if (now - it->second > timeout){
+                one_hop_neighbors.erase(it->first);
+                neighbors_expired++;
+                neighbor_heard.erase(it++);
+            }
+            else
+                it++;
+        }
+    }
+
+    HI_packet *HI_pkt = dynamic_cast<HI_packet *>(packet::packet_generator::generate("HI_packet"));
+    HI_header *HI_hdr = dynamic_cast<HI_header *>(HI_pkt->getHeader());
+    HI_hdr->setSrcID(CUR);
+    HI_hdr->setDstID(BROCAST_ID);
+    HI_hdr->setPreID(CUR);
+    HI_hdr->setNexID(BROCAST_ID);
+    HI_hdr->setSrcX(getNodePos(CUR).first);
+    HI_hdr->setSrcY(getNodePos(CUR).second);
+    send_owned(HI_pkt); // the beacon is not copied; the send_event owns it
+    beacons++;
+    beacons_sent++;
 }
 
 // you have to write the code in recv_handler
@@ -1942,6 +4593,11 @@ void GR_node::recv_handler(packet *p) //ccu
         }
         else if(it != coord_table.end()){//dst在table裡
             //cout<<"state table :"<<DST<<endl;
+            if (SRC == CUR && GR_pld->getMsg() == "default" && path_cached.find(DST) != path_cached.end()){
+                pair<double, double> home = nearest_home(DST, CUR);
+                cache_hits++;
+                saved_hops += 2 * greedy_hops(CUR, home.first, home.second);//來回各一趟
+            }
             GR_pld->setMsg("ok");
             GR_hdr->setDstX(it->second.first);
             GR_hdr->setDstY(it->second.second);
@@ -1949,73 +4605,51 @@ void GR_node::recv_handler(packet *p) //ccu
         else if(GR_pld->getMsg() == "default"){//找不到dst，送出Ret_packet
 
             //cout<<"state send ret"<<DST<<" "<<GR_pld->getMsg()<<endl;
+            cache_misses++;
             GR_packet *cache = dynamic_cast<GR_packet*>(packet::packet_generator::replicate(p));
             GR_wait.push_back(cache);//複製並暫存
-
-            Ret_packet *RET_pkt = dynamic_cast<Ret_packet *> (packet::packet_generator::generate("Ret_packet"));
-            Ret_header *RET_hdr = dynamic_cast<Ret_header *>(RET_pkt->getHeader());
-            Ret_payload *RET_pld = dynamic_cast<Ret_payload *>(RET_pkt->getPayload());
-            
-            pair<unsigned int, unsigned int> hash; //ccu
-            hash = myHash(DST);
-
-            RET_hdr->setDstX(hash.first);
-            RET_hdr->setDstY(hash.second);
-            RET_hdr->setSrcX(GR_hdr->getSrcX());
-            RET_hdr->setSrcY(GR_hdr->getSrcY());
-            RET_hdr->setcacheID(GR_pkt->getPacketID());//紀錄暫存封包的ID
-
-            double min = dst(CUR, hash.first, hash.second);
-
-            for (iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
-                if (iter->second && dst(iter->first, hash.first, hash.second) < min){
-                    min = dst(iter->first, hash.first, hash.second);
-                    NEXT = iter->first;
-                }
+            send_lookup(cache);
+            if (LOOKUP_TIMEOUT != 0){
+                lookup_wait &w = lookup_waits[cache->getPacketID()];
+                w.timer = schedule_timer(ticks_to_time(LOOKUP_TIMEOUT), LOOKUP_TIMER, cache->getPacketID());
+                w.tries = 0;
             }
-            
-            RET_hdr->setSrcID(CUR);
-            RET_hdr->setDstID(BROCAST_ID);
-            RET_hdr->setPreID(CUR);
-            RET_hdr->setNexID(NEXT);
-
-            RET_pld->setMsg(to_string(DST));
-
-            //!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-            if(NEXT != CUR) send_handler(RET_pkt);
-            
-            
-            packet *del = static_cast<packet*> (RET_pkt);
-            packet::discard(del);
             return;
         }
         
         dst_X = GR_hdr->getDstX();
         dst_Y = GR_hdr->getDstY();
         
-        double min = dst(CUR, dst_X, dst_Y);
-
-        for (iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
-            if (iter->second && dst(iter->first, dst_X, dst_Y) < min){
-                min = dst(iter->first, dst_X, dst_Y);
-                NEXT = iter->first;
-            }
-        }
+        NEXT = next_hop(GR_hdr, dst_X, dst_Y);
         
         GR_pkt->getHeader()->setPreID(CUR);
         GR_pkt->getHeader()->setNexID(NEXT);
         
         if (NEXT != CUR) send_handler(GR_pkt);
+        else if (DST == CUR) sim_stats::record_delivery(GR_pkt, CUR);
+        else sim_stats::record_drop(GR_pkt, "local minimum", CUR);
     }
     else if (p->type() == "HI_packet"){
         HI_packet *HI_pkt = dynamic_cast<HI_packet *>(p);
         HI_header *HI_hdr = dynamic_cast<HI_header *>(p->getHeader());
         //cout << "node " << getNodeID() << " send the HI_packet" << endl;
         if (SRC == CUR){
+            HI_hdr->setSrcX(getNodePos(CUR).first);
+            HI_hdr->setSrcY(getNodePos(CUR).second);
             send_handler(HI_pkt);
+            if (HELLO_INTERVAL != 0 && !beaconing){
+                beaconing = true;
+                beacon_timer = schedule_timer(hello_interval(), BEACON_TIMER);
+            }
         }
         else{
             add_one_hop_neighbor(HI_hdr->getSrcID());
+            if (HELLO_INTERVAL != 0){
+                add_coord_table(SRC, HI_hdr->getSrcX(), HI_hdr->getSrcY());//鄰居的最新座標
+                if (NEIGHBOR_TIMEOUT != 0)
+                    neighbor_heard[SRC] = event::getCurTime();
+            }
+            sim_stats::record_delivery(HI_pkt, CUR);
         }
     }
     else if(p->type() == "Rep_packet"){        
@@ -2024,31 +4658,56 @@ void GR_node::recv_handler(packet *p) //ccu
 
         if(SRC == CUR){
             //find dead end
-            pair<unsigned int, unsigned int> hash; //ccu
+            pair<double, double> hash; //ccu
             hash = myHash(CUR);
             REP_hdr->setDstX(hash.first);
             REP_hdr->setDstY(hash.second);
             REP_hdr->setSrcX(getNodePos(CUR).first);
             REP_hdr->setSrcY(getNodePos(CUR).second);
+
+            //其餘的home point各送一個新的Rep_packet
+            for (unsigned int i = 1; i < REP_NUM; i++){
+                Rep_packet *REP_rep = dynamic_cast<Rep_packet *> (packet::packet_generator::generate("Rep_packet"));
+                Rep_header *REP_rep_hdr = dynamic_cast<Rep_header *>(REP_rep->getHeader());
+                Rep_payload *REP_rep_pld = dynamic_cast<Rep_payload *>(REP_rep->getPayload());
+
+                hash = myHash(CUR, i);
+                REP_rep_hdr->setDstX(hash.first);
+                REP_rep_hdr->setDstY(hash.second);
+                REP_rep_hdr->setSrcX(getNodePos(CUR).first);
+                REP_rep_hdr->setSrcY(getNodePos(CUR).second);
+
+                unsigned int REP_next = next_hop(REP_rep_hdr, hash.first, hash.second);
+                REP_rep_hdr->setSrcID(CUR);
+                REP_rep_hdr->setDstID(DST);
+                REP_rep_hdr->setPreID(CUR);
+                REP_rep_hdr->setNexID(REP_next);
+                REP_rep_pld->setMsg(dynamic_cast<Rep_payload *>(REP_pkt->getPayload())->getMsg());
+
+                if (REP_next != CUR) send_handler(REP_rep);
+                else add_home_record(CUR, getNodePos(CUR).first, getNodePos(CUR).second);
+
+                packet *del = static_cast<packet*> (REP_rep);
+                packet::discard(del);
+            }
         }
         double dst_X = REP_hdr->getDstX();
         double dst_Y = REP_hdr->getDstY();
 
-        double min = dst(CUR, dst_X, dst_Y);
-
-        for (iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
-            if (iter->second && dst(iter->first, dst_X, dst_Y) < min){
-                min = dst(iter->first, dst_X, dst_Y);
-                NEXT = iter->first;
-            }
-        }
+        NEXT = next_hop(REP_hdr, dst_X, dst_Y);
         REP_hdr->setPreID(CUR);
         REP_hdr->setNexID(NEXT);
         
         //cout << "node " << getNodeID() << " send the Rep_packet" << endl;//debug
             
-        if (NEXT != CUR) send_handler(REP_pkt); 
-        else add_coord_table(SRC, REP_hdr->getSrcX(), REP_hdr->getSrcY());
+        if (NEXT != CUR){
+            if (SRC != CUR) cache_on_path(SRC, REP_hdr->getSrcX(), REP_hdr->getSrcY());
+            send_handler(REP_pkt); 
+        }
+        else{
+            add_home_record(SRC, REP_hdr->getSrcX(), REP_hdr->getSrcY());
+            sim_stats::record_delivery(REP_pkt, CUR);
+        }
         
     }
     else if(p->type() == "Ret_packet"){
@@ -2060,13 +4719,7 @@ void GR_node::recv_handler(packet *p) //ccu
         double dst_Y = RET_hdr->getDstY();
         unsigned int GR_dst = stoi(RET_pld->getMsg());
   
-        double min = dst(CUR, dst_X, dst_Y);
-        for (iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
-            if (iter->second && dst(iter->first, dst_X, dst_Y) < min){
-                min = dst(iter->first, dst_X, dst_Y);
-                NEXT = iter->first;
-            }
-        }
+        NEXT = next_hop(RET_hdr, dst_X, dst_Y);
               
         if (NEXT != CUR){
             RET_hdr->setPreID(CUR);
@@ -2090,15 +4743,17 @@ void GR_node::recv_handler(packet *p) //ccu
                 RES_hdr->setPreID(CUR);
                 RES_hdr->setNexID(PRE);
                 RES_hdr->setcacheID(RET_hdr->getcacheID());
+                RES_hdr->setretHopNum(RET_hdr->getHopNum());
 
                 RES_pld->setMsg(RET_pld->getMsg());
+                sim_stats::record_delivery(RET_pkt, CUR);
                 
                 send_handler(RES_pkt);
                 packet *del_pkt = static_cast<packet*> (RES_pkt);
                 packet::discard(del_pkt);
                 return;
             }
-            
+            sim_stats::record_drop(RET_pkt, "no record", CUR);
         }
     }
     else if(p->type() == "Res_packet"){
@@ -2110,26 +4765,43 @@ void GR_node::recv_handler(packet *p) //ccu
         //cout << "node " << getNodeID() << " send the Res_packet" << NEXT <<endl;//debug
              
         //*************greedy routing******************
-        double min = dst(CUR, src_X, src_Y);
-        for (iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
-            if (iter->second && dst(iter->first, src_X, src_Y) < min){
-                min = dst(iter->first, src_X, src_Y);
-                NEXT = iter->first;
-            }
-        }
+        NEXT = next_hop(RES_hdr, src_X, src_Y);
         //*********************************************
         RES_hdr->setPreID(CUR);
         RES_hdr->setNexID(NEXT);
 
-        if (DST != CUR) send_handler(RES_pkt);
+        if (DST != CUR){
+            // the requester at DST does not cache the answer to its own lookup, so its reuse is no hit
+            cache_on_path(stoi(dynamic_cast<Res_payload *>(RES_pkt->getPayload())->getMsg()), RES_hdr->getDstX(), RES_hdr->getDstY());
+            send_handler(RES_pkt);
+        }
         else{
-            if(!GR_wait.empty()){
-                list<GR_packet*>::iterator GR_it;
-                for(GR_it = GR_wait.begin(); GR_it != GR_wait.end(); GR_it++)
-                    if((*GR_it)->getPacketID() == RES_hdr->getcacheID())
-                        break;
+            sim_stats::record_delivery(RES_pkt, CUR);
+
+            list<GR_packet*>::iterator GR_it;
+            for(GR_it = GR_wait.begin(); GR_it != GR_wait.end(); GR_it++)
+                if((*GR_it)->getPacketID() == RES_hdr->getcacheID())
+                    break;
+
+            // the packet is no longer waiting if a Res_packet of the same lookup arrived first
+            if(GR_it != GR_wait.end()){
+                // only the answer which releases the packet counts; a late one of an expired lookup does not
+                if (LOOKUP_REPORT){
+                    lookup_record rec;
+                    rec.pktID = RES_hdr->getcacheID();
+                    rec.dstID = stoi(dynamic_cast<Res_payload *>(RES_pkt->getPayload())->getMsg());
+                    rec.homeID = SRC;
+                    rec.hops = RES_hdr->getretHopNum() + RES_hdr->getHopNum();
+                    lookup_log.push_back(rec);
+                }
 
                 GR_packet *GR_pkt = (*GR_it);
+                GR_wait.erase(GR_it);
+                map<unsigned int, lookup_wait>::iterator w = lookup_waits.find(GR_pkt->getPacketID());
+                if (w != lookup_waits.end()){
+                    cancel_timer(w->second.timer);
+                    lookup_waits.erase(w);
+                }
                 GR_header *GR_hdr = dynamic_cast<GR_header*> (GR_pkt->getHeader());
                 GR_payload *GR_pld = dynamic_cast<GR_payload*> (GR_pkt->getPayload());
 
@@ -2137,14 +4809,7 @@ void GR_node::recv_handler(packet *p) //ccu
                 GR_hdr->setDstX(RES_hdr->getDstX());
                 GR_hdr->setDstY(RES_hdr->getDstY());
 
-                double min = dst(CUR, RES_hdr->getDstX(), RES_hdr->getDstY());
-                NEXT = CUR;
-                for (iter = one_hop_neighbors.begin(); iter != one_hop_neighbors.end(); iter++){
-                    if (iter->second && dst(iter->first, RES_hdr->getDstX(), RES_hdr->getDstY()) < min){
-                        min = dst(iter->first, RES_hdr->getDstX(), RES_hdr->getDstY());
-                        NEXT = iter->first;
-                    }
-                }
+                NEXT = next_hop(GR_hdr, RES_hdr->getDstX(), RES_hdr->getDstY());
                 GR_hdr->setPreID(CUR);
                 GR_hdr->setNexID(NEXT);
                 send_handler(GR_pkt);
@@ -2152,6 +4817,8 @@ void GR_node::recv_handler(packet *p) //ccu
                 packet *del_pkt = static_cast<packet*> (GR_pkt);
                 packet::discard(del_pkt);
             }
+            else if(REP_NUM <= 1 && LOOKUP_TIMEOUT == 0)
+                flight_recorder::dump("a Res_packet without a waiting GR_packet"); // with one replica and no timeout there is only one answer
         }
     }
 
@@ -2201,8 +4868,551 @@ void GR_node::recv_handler(packet *p) //ccu
     // note that packet p will be discarded (deleted) after recv_hander(); you don't need to manually delete it
 }
 
-int main() //ccu
+// the scenario is mapped into memory (or read at once if it is not a regular file) and
+// the numbers are parsed in place with from_chars
+class scenario_reader
+{
+    const char *cur;
+    const char *end;
+    unsigned int line; // the line of cur, for error messages
+    void *map_addr;
+    size_t map_len;
+    string copy; // the input when it cannot be mapped, e.g. a pipe
+
+    scenario_reader(scenario_reader &) {}
+
+    // skip the blanks before the next number; false at the end of the input
+    bool skip_space()
+    {
+        while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\n' || *cur == '\r'))
+            if (*cur++ == '\n')
+                line++;
+        return cur < end;
+    }
+    bool fail(const char *what)
+    {
+        cerr << "scenario line " << line << ": expected " << what;
+        if (cur < end)
+        {
+            const char *token_end = cur;
+            while (token_end < end && token_end - cur < 20 && *token_end != ' ' && *token_end != '\n' && *token_end != '\r' && *token_end != '\t')
+                token_end++;
+            cerr << " but found \"" << string(cur, token_end) << "\"";
+        }
+        else
+            cerr << " but reached the end of the input";
+        cerr << endl;
+        return false;
+    }
+
+public:
+    scenario_reader() : cur(nullptr), end(nullptr), line(1), map_addr(MAP_FAILED), map_len(0) {}
+    ~scenario_reader()
+    {
+        if (map_addr != MAP_FAILED)
+            munmap(map_addr, map_len);
+    }
+
+    bool open(const string &path) // an empty path means stdin
+    {
+        FILE *f = path.empty() ? stdin : fopen(path.c_str(), "rb");
+        if (f == nullptr)
+        {
+            cerr << "cannot open scenario " << path << endl;
+            return false;
+        }
+        int fd = fileno(f);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            map_len = st.st_size;
+            map_addr = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map_addr != MAP_FAILED)
+            {
+                madvise(map_addr, map_len, MADV_SEQUENTIAL);
+                cur = (const char *)map_addr;
+                end = cur + map_len;
+            }
+        }
+        if (map_addr == MAP_FAILED)
+        {
+            char buf[1 << 16];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+                copy.append(buf, n);
+            cur = copy.data();
+            end = cur + copy.size();
+        }
+        if (f != stdin)
+            fclose(f);
+        return true;
+    }
+
+    // v is an unsigned int, an unsigned long long or a double
+    template <class T>
+    bool next(T &v, const char *what)
+    {
+        if (!skip_space())
+            return fail(what);
+        from_chars_result r = from_chars(cur, end, v);
+        if (r.ec != errc() || (r.ptr < end && !isspace((unsigned char)*r.ptr)))
+            return fail(what);
+        cur = r.ptr;
+        return true;
+    }
+    GET(getLine, unsigned int, line);
+
+    // the bytes not parsed yet
+    const char *data() const { return cur; }
+    size_t size() const { return end - cur; }
+    bool is_binary() const { return size() >= sizeof(SCENARIO_MAGIC) && memcmp(cur, SCENARIO_MAGIC, sizeof(SCENARIO_MAGIC)) == 0; }
+};
+
+// a binary scenario (see scenario_format.h) used in place, without copying, in the memory of a scenario_reader
+class binary_scenario
+{
+public:
+    const scenario_file_header *hdr;
+    const scenario_node *nodes;
+    const uint64_t *adj_index; // nullptr if the adjacency is not stored
+    const uint32_t *adj_ids;
+    const scenario_pair *pairs;
+
+    binary_scenario() : hdr(nullptr), nodes(nullptr), adj_index(nullptr), adj_ids(nullptr), pairs(nullptr) {}
+
+    // check the header and that every section lies inside the data
+    bool attach(const char *data, size_t size)
+    {
+        hdr = (const scenario_file_header *)data;
+        if (size < sizeof(scenario_file_header) || memcmp(hdr->magic, SCENARIO_MAGIC, sizeof(SCENARIO_MAGIC)) != 0)
+        {
+            cerr << "binary scenario: bad header" << endl;
+            return false;
+        }
+        if (hdr->version != SCENARIO_VERSION)
+        {
+            cerr << "binary scenario: unsupported version " << hdr->version << endl;
+            return false;
+        }
+        if (hdr->pair_num > UINT_MAX)
+        {
+            cerr << "binary scenario: " << hdr->pair_num << " traffic pairs, at most " << UINT_MAX << " are supported" << endl;
+            return false;
+        }
+        if (!inside(size, hdr->node_offset, hdr->node_num, sizeof(scenario_node)) ||
+            !inside(size, hdr->pair_offset, hdr->pair_num, sizeof(scenario_pair)))
+            return false;
+        nodes = (const scenario_node *)(data + hdr->node_offset);
+        pairs = (const scenario_pair *)(data + hdr->pair_offset);
+        if (hdr->flags & SCENARIO_ADJACENCY)
+        {
+            if (!inside(size, hdr->adj_index_offset, (uint64_t)hdr->node_num + 1, sizeof(uint64_t)) ||
+                !inside(size, hdr->adj_ids_offset, hdr->edge_num, sizeof(uint32_t)))
+                return false;
+            adj_index = (const uint64_t *)(data + hdr->adj_index_offset);
+            adj_ids = (const uint32_t *)(data + hdr->adj_ids_offset);
+            if (adj_index[hdr->node_num] != hdr->edge_num)
+            {
+                cerr << "binary scenario: the adjacency index does not match the number of edges" << endl;
+                return false;
+            }
+            for (uint32_t i = 0; i < hdr->node_num; i++)
+                if (adj_index[i] > adj_index[i + 1])
+                {
+                    cerr << "binary scenario: the adjacency index of node " << i << " is not sorted" << endl;
+                    return false;
+                }
+            for (uint64_t k = 0; k < hdr->edge_num; k++)
+                if (adj_ids[k] >= hdr->node_num)
+                {
+                    cerr << "binary scenario: edge " << k << " links to the unknown node " << adj_ids[k] << endl;
+                    return false;
+                }
+        }
+        return true;
+    }
+
+private:
+    // count elements of elem_size bytes at offset (see scenario_section_inside())
+    static bool inside(size_t size, uint64_t offset, uint64_t count, size_t elem_size)
+    {
+        if (!scenario_section_inside(size, offset, count, elem_size))
+        {
+            cerr << "binary scenario: a section at offset " << offset << " is truncated or misaligned" << endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// the traffic pairs of a scenario, read one at a time when the simulation reaches them; the pairs
+// have to be sorted by start time
+class scenario_traffic : public traffic_source
+{
+    scenario_reader *in;        // the text pairs, or
+    const scenario_pair *pairs; // the binary pairs
+    unsigned int left;          // the pairs not read yet
+    unsigned int next_pkt_id;   // the packet id reserved for the next pair
+    scenario_pair next;         // the pair read but not injected yet
+    unsigned int last_time;     // the start time of the pair read last, before any delay
+    unsigned int not_before;    // a delayed pair holds back the pairs after it, so they stay in order
+    bool loaded;
+    bool error;
+
+    scenario_traffic(scenario_traffic &) {}
+
+public:
+    // first_id, if not UINT_MAX, is the first of pair_num ids kept by the stream of a checkpointed run
+    scenario_traffic(scenario_reader *_in, const scenario_pair *_pairs, unsigned int pair_num, unsigned int first_id = UINT_MAX)
+        : in(_in), pairs(_pairs), left(pair_num), last_time(0), not_before(0), loaded(false), error(false)
+    {
+        // the packets created while the pairs wait must not take the ids the pairs get when preloaded
+        next_pkt_id = first_id != UINT_MAX ? first_id : packet::reservePacketIDs(pair_num);
+        next.time = 0;
+    }
+
+    bool peek(unsigned int &t)
+    {
+        if (!loaded)
+        {
+            if (left == 0 || error)
+                return false;
+            if (pairs != nullptr)
+                next = *pairs++;
+            else if (!in->next(next.time, "the start time of a traffic pair") || !in->next(next.src, "a source id") ||
+                     !in->next(next.dst, "a destination id"))
+            {
+                error = true;
+                return false;
+            }
+            left--;
+            if (next.time < last_time)
+            {
+                cerr << "--stream-traffic: the traffic pair starting at " << next.time << " comes after one starting at "
+                     << last_time << "; the pairs have to be sorted by start time" << endl;
+                error = true;
+                return false;
+            }
+            last_time = next.time;
+            loaded = true;
+        }
+        if (next.time < not_before)
+            next.time = not_before;
+        t = next.time;
+        return true;
+    }
+    void inject()
+    {
+        packet::pinPacketID(next_pkt_id++);
+        add_initial_event(next.src, next.dst, next.time);
+        event::countTrafficPair();
+        packet::pinPacketID(UINT_MAX); // the pair was rejected
+        loaded = false;
+    }
+    void delay(unsigned int t) { next.time = not_before = t; }
+    bool failed() const { return error; }
+    void reserved_ids(unsigned int &first, unsigned int &num) const
+    {
+        first = next_pkt_id;
+        num = left + (loaded ? 1 : 0);
+    }
+};
+
+bool checkpoint::save(const string &path)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == nullptr)
+    {
+        cerr << "cannot open checkpoint file " << path << endl;
+        return false;
+    }
+    checkpoint_out out(f);
+    checkpoint_file_header h;
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.reserved = 0;
+    out.put(h);
+    out.put(REP_NUM), out.put(PATH_CACHE), out.put(MIX_HASH), out.put(PERIMETER), out.put(TTL_MAX), out.put(X_MAX), out.put(Y_MAX);
+    out.put(LOOKUP_TIMEOUT), out.put(LOOKUP_RETRIES), out.put(HELLO_INTERVAL), out.put(HELLO_JITTER), out.put(NEIGHBOR_TIMEOUT);
+    packet::saveIDs(out);
+    sim_stats::saveState(out);
+    GR_node::saveState(out);
+    trace_writer::saveState(out);
+    node::saveState(out);
+    event::saveState(out);
+    out.put(CHECKPOINT_END);
+    bool ok = !out.failed();
+    if (fclose(f) != 0 || !ok)
+    {
+        cerr << "cannot write checkpoint file " << path << endl;
+        return false;
+    }
+    cerr << "checkpoint: time " << time_to_string(event::getCurTime()) << ", " << node::getNodeNum() << " nodes, " << event::getPendingNum()
+         << " pending events saved to " << path << endl;
+    return true;
+}
+
+bool checkpoint::load(const string &path)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+    {
+        cerr << "cannot open checkpoint file " << path << endl;
+        return false;
+    }
+    checkpoint_in in(f);
+    checkpoint_file_header h;
+    in.get(h);
+    if (in.failed() || memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0 || h.version != CHECKPOINT_VERSION)
+    {
+        cerr << path << " is not a checkpoint of this version" << endl;
+        fclose(f);
+        return false;
+    }
+    in.get(REP_NUM), in.get(PATH_CACHE), in.get(MIX_HASH), in.get(PERIMETER), in.get(TTL_MAX), in.get(X_MAX), in.get(Y_MAX);
+    in.get(LOOKUP_TIMEOUT), in.get(LOOKUP_RETRIES), in.get(HELLO_INTERVAL), in.get(HELLO_JITTER), in.get(NEIGHBOR_TIMEOUT);
+    packet::loadIDs(in);
+    sim_stats::loadState(in);
+    GR_node::loadState(in);
+    trace_writer::loadState(in);
+    node::loadState(in);
+    event::loadState(in);
+    uint32_t end = 0;
+    in.get(end);
+    fclose(f);
+    if (in.failed() || end != CHECKPOINT_END)
+    {
+        cerr << "checkpoint file " << path << " is truncated or corrupt" << endl;
+        return false;
+    }
+    return true;
+}
+
+// the size, speed and memory use of the run, for --summary
+void print_summary(unsigned int nodeNum, unsigned int pairs, double load_sec, double sim_sec)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double events_per_sec = sim_sec > 0 ? event::getProcessed() / sim_sec : 0;
+    if (SUMMARY == "json")
+    {
+        cerr << "{\"nodes\": " << nodeNum << ", \"pairs\": " << pairs << ", \"events\": " << event::getProcessed()
+             << ", \"load_sec\": " << load_sec << ", \"sim_sec\": " << sim_sec << ", \"events_per_sec\": " << events_per_sec
+             << ", \"peak_pending_events\": " << event::getPeakPending() << ", \"peak_live_packets\": " << event::getPeakLivePackets()
+             << ", \"peak_rss_kb\": " << usage.ru_maxrss << "}" << endl;
+        return;
+    }
+    cerr << "nodes " << nodeNum << "   pairs " << pairs << "   events " << event::getProcessed() << endl
+         << "load " << load_sec << " s   simulation " << sim_sec << " s   " << events_per_sec << " events/s" << endl
+         << "peak pending events " << event::getPeakPending() << "   peak live packets " << event::getPeakLivePackets()
+         << "   peak RSS " << usage.ru_maxrss << " KB" << endl;
+}
+
+void print_usage(const char *program)
+{
+    cerr << "usage: " << program << " [options] [--scenario=path] [--stream-traffic] < scenario" << endl
+         << "  routing:  --replicas=k --hash=std|mix --path-cache --perimeter --ttl=n" << endl
+         << "            --lookup-timeout=time --lookup-retries=n" << endl
+         << "            --hello-interval=time --hello-jitter=time --neighbor-timeout=time" << endl
+         << "  reports:  --lookup-report --home-report --hop-stats --summary=text|json --progress=sec" << endl
+         << "            --stats=csv|json --stats-file=path --stats-interval=time" << endl
+         << "  trace:    --trace=off|data|all --trace-types=type,... --trace-sample=n" << endl
+         << "            --trace-file=path --trace-buffer=bytes --trace-format=text|binary" << endl
+         << "  watchdog: --max-events=n --max-packets=n --storm-policy=drop|delay|abort" << endl
+         << "            --storm-drop=type,... --storm-delay=time" << endl
+         << "  state:    --checkpoint=path --checkpoint-at=time --restore=path --record=path --replay=path" << endl
+         << "  debug:    --flight-recorder=events --flight-file=path" << endl
+         << "  profile:  --profile=table|folded --profile-file=path --profile-sample=n --profile-depth-step=time" << endl;
+}
+
+// the function is used to set the runtime options from the command line
+bool parse_options(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i], value;
+        bool bad = false; // a number option with a wrong value
+        unsigned long long ticks = 0;
+        if (option_number(arg, "lookup-timeout", LOOKUP_TIMEOUT, bad) ||
+            option_number(arg, "lookup-retries", LOOKUP_RETRIES, bad) ||
+            option_number(arg, "hello-interval", HELLO_INTERVAL, bad) ||
+            option_number(arg, "hello-jitter", HELLO_JITTER, bad) ||
+            option_number(arg, "neighbor-timeout", NEIGHBOR_TIMEOUT, bad) ||
+            option_number(arg, "trace-buffer", TRACE_BUFFER, bad) ||
+            option_number(arg, "trace-sample", TRACE_SAMPLE, bad) ||
+            option_number(arg, "stats-interval", STATS_INTERVAL, bad) ||
+            option_number(arg, "max-events", MAX_EVENTS, bad) || option_number(arg, "flight-recorder", FLIGHT_RECORDS, bad))
+        {
+            // only a number; a wrong value is reported below
+        }
+        else if (option_number(arg, "ttl", TTL_MAX, bad))
+            TTL_GIVEN = true;
+        else if (option_number(arg, "replicas", REP_NUM, bad))
+        {
+            if (REP_NUM == 0)
+            {
+                cerr << "--replicas should be at least 1" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--lookup-report")
+            LOOKUP_REPORT = true;
+        else if (arg == "--path-cache")
+            PATH_CACHE = true;
+        else if (option_value(arg, "hash", value) && (value == "std" || value == "mix"))
+            MIX_HASH = (value == "mix");
+        else if (arg == "--home-report")
+            HOME_REPORT = true;
+        else if (arg == "--perimeter")
+            PERIMETER = true;
+        else if (arg == "--hop-stats")
+            HOP_STATS = true;
+        else if (option_value(arg, "trace-file", value))
+            TRACE_FILE = value;
+        else if (option_value(arg, "trace-format", value) && (value == "text" || value == "binary"))
+            TRACE_BINARY = (value == "binary");
+        else if (option_value(arg, "trace", value) && (value == "off" || value == "data" || value == "all"))
+        {
+            TRACE_ON = (value != "off");
+            TRACE_TYPES.clear();
+            if (value == "data")
+                TRACE_TYPES["GR_packet"] = true;
+        }
+        else if (option_value(arg, "trace-types", value))
+        {
+            // a comma separated list such as GR_packet,Ret_packet
+            TRACE_TYPES.clear();
+            for (size_t begin = 0, end; begin <= value.size(); begin = end + 1)
+            {
+                end = value.find(',', begin);
+                if (end == string::npos)
+                    end = value.size();
+                if (end == begin)
+                    continue;
+                string type = value.substr(begin, end - begin);
+                if (!packet::packet_generator::known(type))
+                {
+                    cerr << "--trace-types: no packet type " << type << endl;
+                    return false;
+                }
+                TRACE_TYPES[type] = true;
+            }
+        }
+        else if (option_value(arg, "scenario", value))
+            SCENARIO_FILE = value;
+        else if (arg == "--stream-traffic")
+            STREAM_TRAFFIC = true;
+        else if (option_value(arg, "summary", value) && (value == "text" || value == "json"))
+            SUMMARY = value;
+        else if (option_value(arg, "stats", value) && (value == "csv" || value == "json"))
+            STATS_FORMAT = value;
+        else if (option_value(arg, "stats-file", value))
+            STATS_FILE = value;
+        else if (option_value(arg, "profile", value) && (value == "table" || value == "folded"))
+            PROFILE = value;
+        else if (option_value(arg, "profile-file", value))
+            PROFILE_FILE = value;
+        else if (option_number(arg, "profile-sample", PROFILE_SAMPLE, bad))
+            bad = bad || PROFILE_SAMPLE == 0;
+        else if (option_number(arg, "profile-depth-step", PROFILE_DEPTH_STEP, bad))
+            bad = bad || PROFILE_DEPTH_STEP == 0;
+        else if (option_number(arg, "progress", PROGRESS_INTERVAL, bad))
+            bad = bad || !(PROGRESS_INTERVAL > 0);
+        else if (option_number(arg, "max-packets", MAX_PACKETS, bad))
+            bad = bad || MAX_PACKETS < 0;
+        else if (option_value(arg, "storm-policy", value) && (value == "drop" || value == "delay" || value == "abort"))
+            STORM_POLICY = value;
+        else if (option_value(arg, "storm-drop", value))
+        {
+            STORM_DROP.clear();
+            for (size_t begin = 0, end; begin <= value.size(); begin = end + 1)
+            {
+                end = value.find(',', begin);
+                if (end == string::npos)
+                    end = value.size();
+                if (end > begin)
+                    STORM_DROP[value.substr(begin, end - begin)] = true;
+            }
+        }
+        else if (option_number(arg, "storm-delay", STORM_DELAY, bad))
+            bad = bad || STORM_DELAY == 0;
+        else if (option_value(arg, "checkpoint", value))
+            CHECKPOINT_FILE = value;
+        else if (option_number(arg, "checkpoint-at", ticks, bad))
+        {
+            if (ticks > time_to_ticks(SIM_TIME_MAX))
+            {
+                cerr << "--checkpoint-at should be at most " << time_to_ticks(SIM_TIME_MAX) << endl;
+                return false;
+            }
+            CHECKPOINT_AT = ticks_to_time(ticks);
+        }
+        else if (option_value(arg, "restore", value))
+            RESTORE_FILE = value;
+        else if (option_value(arg, "record", value))
+            RECORD_FILE = value;
+        else if (option_value(arg, "replay", value))
+            REPLAY_FILE = value;
+        else if (option_value(arg, "flight-file", value))
+            FLIGHT_FILE = value;
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            print_usage(argv[0]);
+            return false;
+        }
+        if (bad)
+        {
+            cerr << "wrong value in " << arg << endl;
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    if (LOOKUP_RETRIES != 0 && LOOKUP_TIMEOUT == 0)
+    {
+        cerr << "--lookup-retries=n needs --lookup-timeout=time" << endl;
+        return false;
+    }
+    if ((HELLO_JITTER != 0 || NEIGHBOR_TIMEOUT != 0) && HELLO_INTERVAL == 0)
+    {
+        cerr << "--hello-jitter and --neighbor-timeout need --hello-interval=time" << endl;
+        return false;
+    }
+    if (HELLO_JITTER >= HELLO_INTERVAL && HELLO_INTERVAL != 0)
+    {
+        cerr << "--hello-jitter should be less than --hello-interval" << endl;
+        return false;
+    }
+    if (NEIGHBOR_TIMEOUT != 0 && NEIGHBOR_TIMEOUT <= HELLO_INTERVAL + HELLO_JITTER)
+    {
+        cerr << "--neighbor-timeout should be longer than --hello-interval plus --hello-jitter" << endl;
+        return false;
+    }
+    if (!RECORD_FILE.empty() && !REPLAY_FILE.empty())
+    {
+        cerr << "--record and --replay cannot be used together" << endl;
+        return false;
+    }
+    if (CHECKPOINT_FILE.empty() != (CHECKPOINT_AT == SIM_TIME_MAX))
+    {
+        cerr << "--checkpoint=path and --checkpoint-at=time go together" << endl;
+        return false;
+    }
+    if (STORM_POLICY == "delay" && !STREAM_TRAFFIC && (MAX_EVENTS != 0 || MAX_PACKETS != 0))
+    {
+        cerr << "--storm-policy=delay postpones the pairs of --stream-traffic; the preloaded pairs cannot be delayed" << endl;
+        return false;
+    }
+    return true;
+}
+
+// microbench.cpp includes this file with HW4_NO_MAIN to call the classes directly
+#ifndef HW4_NO_MAIN
+int main(int argc, char *argv[]) //ccu
 {
+    if (!parse_options(argc, argv))
+        return 1;
+
     // header::header_generator::print(); // print all registered headers
     // payload::payload_generator::print(); // print all registered payloads
     // packet::packet_generator::print(); // print all registered packets
@@ -2210,8 +5420,38 @@ int main() //ccu
     // event::event_generator::print(); // print all registered events
     // link::link_generator::print(); // print all registered links
 
+    chrono::steady_clock::time_point load_begin = chrono::steady_clock::now();
+    scenario_reader in;
+    if (!in.open(SCENARIO_FILE))
+        return 1;
+
+    binary_scenario bin;
+    bool binary = in.is_binary();
+    if (binary && !RESTORE_FILE.empty()){
+        cerr << "--restore reads the traffic in the text format: pair_num end_time, then t src dst per pair" << endl;
+        return 1;
+    }
+    if (binary && !bin.attach(in.data(), in.size()))
+        return 1;
+
     unsigned int nodeNum;
-    cin >> nodeNum >> X_MAX >> Y_MAX;
+    if (!RESTORE_FILE.empty()){
+        // the nodes, their tables and the pending events come from the checkpoint; only the traffic is read
+        if (!checkpoint::load(RESTORE_FILE))
+            return 1;
+        nodeNum = 0;
+    }
+    else if (binary){
+        nodeNum = bin.hdr->node_num;
+        X_MAX = bin.hdr->x_max;
+        Y_MAX = bin.hdr->y_max;
+    }
+    else if (!in.next(nodeNum, "the number of nodes") || !in.next(X_MAX, "X_MAX") || !in.next(Y_MAX, "Y_MAX"))
+        return 1;
+    // a perimeter route crosses each face of the planar subgraph at most once, so it takes at most 2E <= 6N
+    // face hops and N greedy ones; a restored run keeps the TTL of its checkpoint
+    if (PERIMETER && !TTL_GIVEN && RESTORE_FILE.empty())
+        TTL_MAX = (unsigned int)min<unsigned long long>(UINT_MAX, max<unsigned long long>(TTL_MAX, 7ULL * nodeNum));
 
     for (unsigned int id = 0; id < nodeNum; id++){
         node::node_generator::generate("GR_node", id);
@@ -2220,31 +5460,120 @@ int main() //ccu
     double x, y;
     pair<double, double> coordinate;
     for (unsigned int i = 0; i < nodeNum; i++){
-        cin >> id >> x >> y >> BR_time >> Rep_time;
+        if (binary){
+            id = i;
+            x = bin.nodes[i].x;
+            y = bin.nodes[i].y;
+            BR_time = bin.nodes[i].hello_time;
+            Rep_time = bin.nodes[i].publish_time;
+        }
+        else if (!in.next(id, "a node id") || !in.next(x, "the x coordinate") || !in.next(y, "the y coordinate") ||
+                 !in.next(BR_time, "the hello time") || !in.next(Rep_time, "the publish time"))
+            return 1;
+        if (id != i){
+            cerr << "scenario line " << in.getLine() << ": expected node " << i << " but found node " << id << endl;
+            return 1;
+        }
         add_initial_event(id, BROCAST_ID, BR_time, "hello");
         add_initial_event(id, BROCAST_ID, Rep_time, "publish");
         coordinate = make_pair(x, y);
         setNodePos(i, coordinate);
-        for (unsigned int j = 0; j < i; j++){
-            if (dst(i, j) <= 1.){
-                node::id_to_node(i)->add_phy_neighbor(j);
-                node::id_to_node(j)->add_phy_neighbor(i);
-            }
-        }
     }
 
-    unsigned int pairs, time;
-    cin >> pairs >> time;
+    // the nodes within radio range are physical neighbors
+    if (!RESTORE_FILE.empty())
+        nodeNum = node::getNodeNum(); // the links came with the checkpoint
+    else if (bin.adj_index != nullptr){
+        for (unsigned int i = 0; i < nodeNum; i++)
+            for (uint64_t k = bin.adj_index[i]; k < bin.adj_index[i + 1]; k++)
+                node::id_to_node(i)->add_phy_neighbor(bin.adj_ids[k]);
+    }
+    else{
+        grid_neighbors(nodeNum,
+                       [](uint32_t i, double &_x, double &_y) { pair<double, double> pos = getNodePos(i); _x = pos.first; _y = pos.second; },
+                       [](uint32_t i, uint32_t j) {
+                           node::id_to_node(i)->add_phy_neighbor(j);
+                           node::id_to_node(j)->add_phy_neighbor(i);
+                       });
+    }
+
+    unsigned int pairs;
+    unsigned long long time; // in whole ticks; only the text format allows an end time past UINT_MAX
+    if (binary){
+        pairs = bin.hdr->pair_num;
+        time = bin.hdr->end_time;
+    }
+    else if (!in.next(pairs, "the number of traffic pairs") || !in.next(time, "the end time"))
+        return 1;
+    if (time > time_to_ticks(SIM_TIME_MAX)){
+        cerr << "the end time should be at most " << time_to_ticks(SIM_TIME_MAX) << endl;
+        return 1;
+    }
 
+    unsigned int pair_num = pairs;
+    // a restored run reads the traffic of the checkpointed run again: its first pairs are pending in the
+    // checkpoint already (all of them unless --stream-traffic), so they are skipped
+    unsigned long long skipped = event::getTrafficPairs();
+    if (skipped > pairs){
+        cerr << "the checkpoint has scheduled " << skipped << " traffic pairs, but the traffic has only " << pairs << endl;
+        return 1;
+    }
+    for (unsigned long long round = 0; round < skipped; round++){
+        unsigned int t, src, dst;
+        if (!in.next(t, "the start time of a traffic pair") || !in.next(src, "a source id") || !in.next(dst, "a destination id"))
+            return 1;
+    }
+    pairs -= skipped;
+    unsigned int first_id, id_num;
+    event::getTrafficIDs(first_id, id_num);
+    scenario_traffic traffic(binary ? nullptr : &in, binary ? bin.pairs : nullptr, STREAM_TRAFFIC ? pairs : 0,
+                             STREAM_TRAFFIC && pairs <= id_num ? first_id : UINT_MAX);
+    if (STREAM_TRAFFIC){
+        event::setTrafficSource(&traffic);
+        pairs = 0;
+    }
     for (unsigned int round = 0; round < pairs; round++){
         unsigned int t, src, dst;
-        cin >> t >> src >> dst;
+        if (binary){
+            t = bin.pairs[round].time;
+            src = bin.pairs[round].src;
+            dst = bin.pairs[round].dst;
+        }
+        else if (!in.next(t, "the start time of a traffic pair") || !in.next(src, "a source id") || !in.next(dst, "a destination id"))
+            return 1;
+        if (ticks_to_time(t) < event::getCurTime()){
+            cerr << "the traffic pair starting at " << t << " starts before the checkpoint at " << time_to_string(event::getCurTime()) << endl;
+            return 1;
+        }
         add_initial_event(src, dst, t);
+        event::countTrafficPair();
     }
 
     // start simulation!!
     //event::start_simulate(time);
-    event::start_simulate(time);
+    chrono::steady_clock::time_point sim_begin = chrono::steady_clock::now();
+    event::start_simulate(ticks_to_time(time));
+    chrono::steady_clock::time_point sim_end = chrono::steady_clock::now();
+    if (traffic.failed())
+        return 1;
+    if (watchdog::aborted())
+        return 2;
+    if (replay_log::diverged())
+        return 3;
+    if (!SUMMARY.empty())
+        print_summary(nodeNum, pair_num, chrono::duration<double>(sim_begin - load_begin).count(),
+                      chrono::duration<double>(sim_end - sim_begin).count());
+
+    if (LOOKUP_REPORT)
+        GR_node::print_lookup_log();
+    if (PATH_CACHE)
+        GR_node::print_cache_stats();
+    if (HOME_REPORT)
+        GR_node::print_home_records();
+    if (HELLO_INTERVAL != 0)
+        GR_node::print_hello_stats();
+    if (HOP_STATS)
+        sim_stats::print();
 
     //  for(int i = 0; i < nodeNum; i++){
     //      GR_node *n = dynamic_cast<GR_node*> (node::id_to_node(i));
@@ -2255,4 +5584,5 @@ int main() //ccu
     //event::flush_events() ;
     //cout << packet::getLivePacketNum() << endl;
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,204 @@
+// microbench times the hot primitives of hw4 one by one and counts their heap allocations
+// usage: microbench [--nodes=n] [--iters=n] [--filter=name]
+// the network is a lattice of n nodes whose hello and publish phases are simulated first, so the
+// neighbor and location tables are filled as in a real run
+#define HW4_NO_MAIN
+#include "hw4.cpp"
+
+#include <cstdlib>
+#include <new>
+
+static unsigned long long alloc_count = 0;
+
+void *operator new(size_t size)
+{
+    alloc_count++;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+volatile unsigned long long bench_sink; // the results are written here so they are not optimized away
+
+class microbench
+{
+public:
+    static unsigned long long iters;
+    static string filter;
+
+    // run op(i) iters times in batches of batch; cleanup() runs after each batch and is not timed
+    template <class op_func, class cleanup_func>
+    static void run(const string &name, op_func op, cleanup_func cleanup, unsigned long long batch = 1024)
+    {
+        if (!filter.empty() && name.find(filter) == string::npos)
+            return;
+        for (unsigned long long i = 0; i < batch && i < iters; i++) // warm up
+            op(i);
+        cleanup();
+        chrono::steady_clock::duration elapsed(0);
+        unsigned long long allocs = 0;
+        for (unsigned long long done = 0; done < iters; done += batch)
+        {
+            unsigned long long end = done + batch < iters ? done + batch : iters;
+            unsigned long long alloc_begin = alloc_count;
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            for (unsigned long long i = done; i < end; i++)
+                op(i);
+            elapsed += chrono::steady_clock::now() - begin;
+            allocs += alloc_count - alloc_begin;
+            cleanup();
+        }
+        printf("%-32s %10.1f ns/op %8.2f allocs/op\n", name.c_str(),
+               chrono::duration<double, nano>(elapsed).count() / iters, (double)allocs / iters);
+    }
+    template <class op_func>
+    static void run(const string &name, op_func op)
+    {
+        run(name, op, []() {});
+    }
+};
+unsigned long long microbench::iters = 1000000;
+string microbench::filter = "";
+
+// a lattice of node_num GR_nodes with about 8 neighbors each, after its hello and publish phases
+void build_network(unsigned int node_num)
+{
+    unsigned int columns = (unsigned int)ceil(sqrt((double)node_num));
+    double spacing = 0.6;
+    X_MAX = Y_MAX = (unsigned int)ceil(columns * spacing * 10000);
+    for (unsigned int id = 0; id < node_num; id++)
+    {
+        node::node_generator::generate("GR_node", id);
+        setNodePos(id, make_pair((id % columns + 0.5) * spacing, (id / columns + 0.5) * spacing));
+    }
+    grid_neighbors(node_num,
+                   [](uint32_t i, double &x, double &y) { pair<double, double> pos = getNodePos(i); x = pos.first; y = pos.second; },
+                   [](uint32_t i, uint32_t j) {
+                       node::id_to_node(i)->add_phy_neighbor(j);
+                       node::id_to_node(j)->add_phy_neighbor(i);
+                   });
+    for (unsigned int id = 0; id < node_num; id++)
+    {
+        add_initial_event(id, BROCAST_ID, 10, "hello");
+        add_initial_event(id, BROCAST_ID, 100, "publish");
+    }
+    TRACE_ON = false;
+    event::start_simulate(SIM_TIME_MAX);
+}
+
+// a packet of type pkt_type as it arrives at cur from pre, on its way to the far corner (x, y)
+packet *make_packet(const string &pkt_type, unsigned int src, unsigned int dst, unsigned int pre, double x, double y)
+{
+    packet *p = packet::packet_generator::generate(pkt_type);
+    header *h = p->getHeader();
+    h->setSrcID(src);
+    h->setDstID(dst);
+    h->setPreID(pre);
+    if (GR_header *hdr = dynamic_cast<GR_header *>(h))
+    {
+        hdr->setDstX(x);
+        hdr->setDstY(y);
+        dynamic_cast<GR_payload *>(p->getPayload())->setMsg("ok");
+    }
+    else if (Rep_header *hdr = dynamic_cast<Rep_header *>(h))
+    {
+        hdr->setDstX(x);
+        hdr->setDstY(y);
+    }
+    else if (Ret_header *hdr = dynamic_cast<Ret_header *>(h))
+    {
+        hdr->setDstX(x);
+        hdr->setDstY(y);
+        dynamic_cast<Ret_payload *>(p->getPayload())->setMsg(to_string(dst));
+        h->setDstID(BROCAST_ID);
+    }
+    else if (Res_header *hdr = dynamic_cast<Res_header *>(h))
+    {
+        hdr->setSrcX(x);
+        hdr->setSrcY(y);
+        dynamic_cast<Res_payload *>(p->getPayload())->setMsg(to_string(dst));
+    }
+    return p;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int node_num = 1024;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i], value;
+        bool bad = false; // a number option with a wrong value
+        if (option_number(arg, "nodes", node_num, bad) || option_number(arg, "iters", microbench::iters, bad))
+        {
+            // only a number; a wrong value is reported below
+        }
+        else if (option_value(arg, "filter", value))
+            microbench::filter = value;
+        else
+            bad = true;
+        if (bad)
+        {
+            cerr << "usage: " << argv[0] << " [--nodes=n] [--iters=n] [--filter=name]" << endl;
+            return 1;
+        }
+    }
+    if (node_num < 16)
+        node_num = 16;
+    build_network(node_num);
+    unsigned int last = node_num - 1;
+    pair<double, double> far = getNodePos(last);
+
+    // a few pending events to compare
+    vector<event *> pending;
+    for (unsigned int i = 0; i < 64; i++)
+    {
+        recv_event::recv_data data;
+        data.s_id = i % node_num;
+        data.r_id = (i + 1) % node_num;
+        data._pkt = make_packet("GR_packet", i, last, i, far.first, far.second);
+        pending.push_back(event::event_generator::generate("recv_event", event::getCurTime() + ticks_to_time(i % 4), (void *)&data));
+    }
+    mycomp comp;
+    microbench::run("mycomp::operator()", [&](unsigned long long i) { bench_sink += comp(pending[i & 63], pending[(i + 1) & 63]); });
+    microbench::run("event_priority", [&](unsigned long long i) { bench_sink += pending[i & 63]->event_priority(); });
+    event::discard_events();
+
+    packet *gr = make_packet("GR_packet", 0, last, 0, far.first, far.second);
+    microbench::run("packet_generator::replicate", [&](unsigned long long) {
+        packet *p = packet::packet_generator::replicate(gr);
+        packet::discard(p);
+    });
+
+    microbench::run("node::id_to_node", [&](unsigned long long i) { bench_sink += (size_t)node::id_to_node(i % node_num); });
+    vector<pair<unsigned int, unsigned int>> links;
+    grid_neighbors(node_num,
+                   [](uint32_t i, double &x, double &y) { pair<double, double> pos = getNodePos(i); x = pos.first; y = pos.second; },
+                   [&links](uint32_t i, uint32_t j) { links.push_back(make_pair(j, i)); });
+    microbench::run("link::id_id_to_link", [&](unsigned long long i) {
+        const pair<unsigned int, unsigned int> &l = links[i % links.size()];
+        bench_sink += (size_t)link::id_id_to_link(l.first, l.second);
+    });
+    microbench::run("getNodePos", [&](unsigned long long i) { bench_sink += getNodePos(i % node_num).first; });
+    microbench::run("dst", [&](unsigned long long i) { bench_sink += dst(i % node_num, (i * 7) % node_num); });
+    microbench::run("myHash", [&](unsigned long long i) { bench_sink += myHash(i % node_num).first; });
+
+    // one hop of each packet type at node 0; the events the handler schedules are discarded between batches
+    const char *types[] = {"GR_packet", "HI_packet", "Rep_packet", "Ret_packet", "Res_packet"};
+    node *cur = node::id_to_node(0);
+    unsigned int pre = 1; // the next node of the first row
+    for (const char *type : types)
+    {
+        packet *templ = make_packet(type, pre, last, pre, far.first, far.second);
+        microbench::run(string("recv_handler ") + type, [&](unsigned long long) {
+            packet *p = packet::packet_generator::replicate(templ);
+            cur->recv_handler(p);
+            packet::discard(p);
+        }, []() { event::discard_events(); });
+        packet::discard(templ);
+    }
+    packet::discard(gr);
+    return 0;
+}
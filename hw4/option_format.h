@@ -0,0 +1,47 @@
+// the --name=value command line options of hw4 and of its tools
+// a numeric value is read with from_chars: it has to be a whole number of the type of the option (no
+// sign for an unsigned type, and within its range), so a wrong value is reported instead of aborting
+// the program or being truncated
+#ifndef OPTION_FORMAT_H
+#define OPTION_FORMAT_H
+
+#include <string>
+#include <charconv>
+#include <system_error>
+
+// if arg is "--name=value", value is set and true is returned
+inline bool option_value(const std::string &arg, const std::string &name, std::string &value)
+{
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+// true and v set if the whole of value is a number of the type of v
+template <class T>
+bool parse_number(const std::string &value, T &v)
+{
+    T n;
+    std::from_chars_result r = std::from_chars(value.data(), value.data() + value.size(), n);
+    if (value.empty() || r.ec != std::errc() || r.ptr != value.data() + value.size())
+        return false;
+    v = n;
+    return true;
+}
+
+// if arg is "--name=value", v is set to the number value and true is returned; bad is set instead
+// if value is not a number of the type of v
+template <class T>
+bool option_number(const std::string &arg, const std::string &name, T &v, bool &bad)
+{
+    std::string value;
+    if (!option_value(arg, name, value))
+        return false;
+    if (!parse_number(value, v))
+        bad = true;
+    return true;
+}
+
+#endif
@@ -0,0 +1,185 @@
+// scenario_convert turns a text scenario of hw4 into the binary scenario of scenario_format.h, or back
+// usage: scenario_convert [--adjacency] in.txt out.bin
+//        scenario_convert --to-text in.bin out.txt
+// with --adjacency the physical neighbors are computed once here and hw4 does not search for them
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cctype>
+#include <charconv>
+#include "scenario_format.h"
+
+using namespace std;
+
+// the numbers of a text scenario, read one after another
+class text_tokens
+{
+    string text;
+    size_t pos;
+    unsigned int line;
+
+    bool token(const char *what, string &tok)
+    {
+        while (pos < text.size() && isspace((unsigned char)text[pos]))
+            if (text[pos++] == '\n')
+                line++;
+        size_t begin = pos;
+        while (pos < text.size() && !isspace((unsigned char)text[pos]))
+            pos++;
+        tok = text.substr(begin, pos - begin);
+        if (tok.empty())
+            cerr << "line " << line << ": expected " << what << " but reached the end of the input" << endl;
+        return !tok.empty();
+    }
+    bool fail(const char *what, const string &tok)
+    {
+        cerr << "line " << line << ": expected " << what << " but found \"" << tok << "\"" << endl;
+        return false;
+    }
+
+public:
+    text_tokens() : pos(0), line(1) {}
+
+    bool load(FILE *in)
+    {
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+            text.append(buf, n);
+        return !ferror(in);
+    }
+    bool next(uint32_t &v, const char *what)
+    {
+        string tok;
+        if (!token(what, tok))
+            return false;
+        from_chars_result r = from_chars(tok.data(), tok.data() + tok.size(), v);
+        return (r.ec == errc() && r.ptr == tok.data() + tok.size()) || fail(what, tok);
+    }
+    bool next(double &v, const char *what)
+    {
+        string tok;
+        if (!token(what, tok))
+            return false;
+        from_chars_result r = from_chars(tok.data(), tok.data() + tok.size(), v);
+        return (r.ec == errc() && r.ptr == tok.data() + tok.size()) || fail(what, tok);
+    }
+    unsigned int getLine() const { return line; }
+};
+
+bool text_to_binary(FILE *in, FILE *out, bool adjacency)
+{
+    text_tokens tokens;
+    if (!tokens.load(in))
+        return false;
+    uint32_t node_num, x_max, y_max;
+    if (!tokens.next(node_num, "the number of nodes") || !tokens.next(x_max, "X_MAX") || !tokens.next(y_max, "Y_MAX"))
+        return false;
+    vector<scenario_node> nodes(node_num);
+    for (uint32_t i = 0; i < node_num; i++)
+    {
+        uint32_t id;
+        if (!tokens.next(id, "a node id") || !tokens.next(nodes[i].x, "the x coordinate") ||
+            !tokens.next(nodes[i].y, "the y coordinate") || !tokens.next(nodes[i].hello_time, "the hello time") ||
+            !tokens.next(nodes[i].publish_time, "the publish time"))
+            return false;
+        if (id != i)
+        {
+            cerr << "line " << tokens.getLine() << ": expected node " << i << " but found node " << id << endl;
+            return false;
+        }
+    }
+    uint32_t pair_num, end_time;
+    if (!tokens.next(pair_num, "the number of traffic pairs") || !tokens.next(end_time, "the end time"))
+        return false;
+    vector<scenario_pair> pairs(pair_num);
+    for (uint32_t i = 0; i < pair_num; i++)
+        if (!tokens.next(pairs[i].time, "the start time of a traffic pair") || !tokens.next(pairs[i].src, "a source id") ||
+            !tokens.next(pairs[i].dst, "a destination id"))
+            return false;
+    return scenario_write(out, x_max, y_max, end_time, nodes, pairs, adjacency);
+}
+
+// the shortest text which reads back as the same double
+string format_double(double v)
+{
+    char buf[32];
+    to_chars_result r = to_chars(buf, buf + sizeof(buf), v);
+    return string(buf, r.ptr);
+}
+
+bool binary_to_text(FILE *in, FILE *out)
+{
+    string data;
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        data.append(buf, n);
+    const scenario_file_header *h = (const scenario_file_header *)data.data();
+    if (data.size() < sizeof(*h) || memcmp(h->magic, SCENARIO_MAGIC, sizeof(SCENARIO_MAGIC)) != 0 || h->version != SCENARIO_VERSION)
+    {
+        cerr << "not a binary scenario of version " << SCENARIO_VERSION << endl;
+        return false;
+    }
+    if (!scenario_section_inside(data.size(), h->node_offset, h->node_num, sizeof(scenario_node)) ||
+        !scenario_section_inside(data.size(), h->pair_offset, h->pair_num, sizeof(scenario_pair)))
+    {
+        cerr << "the binary scenario is truncated or misaligned" << endl;
+        return false;
+    }
+    const scenario_node *nodes = (const scenario_node *)(data.data() + h->node_offset);
+    const scenario_pair *pairs = (const scenario_pair *)(data.data() + h->pair_offset);
+    fprintf(out, "%u %u %u\n", h->node_num, h->x_max, h->y_max);
+    for (uint32_t i = 0; i < h->node_num; i++)
+        fprintf(out, "%u %s %s %u %u\n", i, format_double(nodes[i].x).c_str(), format_double(nodes[i].y).c_str(),
+                nodes[i].hello_time, nodes[i].publish_time);
+    fprintf(out, "%llu %u\n", (unsigned long long)h->pair_num, h->end_time);
+    for (uint64_t i = 0; i < h->pair_num; i++)
+        fprintf(out, "%u %u %u\n", pairs[i].time, pairs[i].src, pairs[i].dst);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool adjacency = false, to_text = false, usage = false;
+    vector<string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--adjacency")
+            adjacency = true;
+        else if (arg == "--to-text")
+            to_text = true;
+        else if (arg.compare(0, 2, "--") != 0)
+            paths.push_back(arg);
+        else
+            usage = true;
+    }
+    if (usage || paths.size() != 2 || (adjacency && to_text))
+    {
+        cerr << "usage: scenario_convert [--adjacency] in.txt out.bin" << endl
+             << "       scenario_convert --to-text in.bin out.txt" << endl;
+        return 1;
+    }
+    FILE *in = fopen(paths[0].c_str(), "rb");
+    if (in == nullptr)
+    {
+        cerr << "cannot open " << paths[0] << endl;
+        return 1;
+    }
+    FILE *out = fopen(paths[1].c_str(), "wb");
+    if (out == nullptr)
+    {
+        cerr << "cannot create " << paths[1] << endl;
+        return 1;
+    }
+    bool ok = to_text ? binary_to_text(in, out) : text_to_binary(in, out, adjacency);
+    fclose(in);
+    if (fclose(out) != 0 || !ok)
+    {
+        cerr << "cannot convert " << paths[0] << endl;
+        return 1;
+    }
+    return 0;
+}
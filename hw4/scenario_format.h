@@ -0,0 +1,179 @@
+// the binary scenario read by hw4 and written by scenario_convert
+//
+// file layout (every section starts at a multiple of 8 bytes):
+//   scenario_file_header
+//   scenario_node * node_num                        at node_offset
+//   uint64_t      * (node_num + 1)                  at adj_index_offset  (only with SCENARIO_ADJACENCY)
+//   uint32_t      * edge_num                        at adj_ids_offset    (only with SCENARIO_ADJACENCY)
+//   scenario_pair * pair_num                        at pair_offset
+// the neighbors of node i are adj_ids[adj_index[i]] .. adj_ids[adj_index[i + 1] - 1]; every link
+// appears once in each direction
+// all integers are stored in the byte order of the machine writing the file
+#ifndef SCENARIO_FORMAT_H
+#define SCENARIO_FORMAT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+const char SCENARIO_MAGIC[8] = {'G', 'R', 'S', 'C', 'E', 'N', 'E', '1'};
+const uint32_t SCENARIO_VERSION = 1;
+const uint32_t SCENARIO_ADJACENCY = 1; // flag: the precomputed adjacency is stored
+
+struct scenario_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t node_num;
+    uint32_t x_max; // in 1/10000 of the coordinate unit, as in the text format
+    uint32_t y_max;
+    uint32_t end_time;
+    uint64_t pair_num;
+    uint64_t edge_num;
+    uint64_t node_offset;
+    uint64_t adj_index_offset;
+    uint64_t adj_ids_offset;
+    uint64_t pair_offset;
+};
+
+// one node line of the text format: id x y BR_time Rep_time (the id is the index)
+struct scenario_node
+{
+    double x;
+    double y;
+    uint32_t hello_time;
+    uint32_t publish_time;
+};
+
+// one traffic line of the text format: t src dst
+struct scenario_pair
+{
+    uint32_t time;
+    uint32_t src;
+    uint32_t dst;
+};
+
+inline uint64_t scenario_align(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+// true if a section of count elements of elem_size bytes at offset is aligned and lies within size
+// bytes; the count is compared with a quotient, so a huge one cannot overflow
+inline bool scenario_section_inside(uint64_t size, uint64_t offset, uint64_t count, uint64_t elem_size)
+{
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / elem_size;
+}
+
+// two nodes are physical neighbors if they are at most one unit apart; this is the test hw4 has
+// always used, so the result does not depend on which program builds the adjacency
+inline bool in_radio_range(double x1, double y1, double x2, double y2)
+{
+    return sqrt(pow((x1 - x2), 2) + pow((y1 - y2), 2)) <= 1.;
+}
+
+// call link(i, j) once for every pair i > j of nodes within radio range; the nodes are bucketed
+// into unit cells, so only the 3x3 cells around a node are searched
+template <class pos_func, class link_func>
+void grid_neighbors(uint32_t node_num, pos_func pos, link_func link)
+{
+    std::vector<std::pair<uint64_t, uint32_t>> cells(node_num); // (cell key, node id)
+    for (uint32_t i = 0; i < node_num; i++)
+    {
+        double x, y;
+        pos(i, x, y);
+        uint64_t cx = (uint64_t)(int64_t)floor(x) + (1u << 31), cy = (uint64_t)(int64_t)floor(y) + (1u << 31);
+        cells[i] = std::make_pair((cx << 32) | (cy & 0xffffffffULL), i);
+    }
+    std::sort(cells.begin(), cells.end());
+    for (uint32_t i = 0; i < node_num; i++)
+    {
+        double x, y;
+        pos(i, x, y);
+        uint64_t cx = (uint64_t)(int64_t)floor(x) + (1u << 31), cy = (uint64_t)(int64_t)floor(y) + (1u << 31);
+        for (uint64_t nx = cx - 1; nx <= cx + 1; nx++)
+            for (uint64_t ny = cy - 1; ny <= cy + 1; ny++)
+            {
+                uint64_t key = (nx << 32) | (ny & 0xffffffffULL);
+                std::vector<std::pair<uint64_t, uint32_t>>::iterator it =
+                    std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, (uint32_t)0));
+                for (; it != cells.end() && it->first == key && it->second < i; it++)
+                {
+                    double x2, y2;
+                    pos(it->second, x2, y2);
+                    if (in_radio_range(x, y, x2, y2))
+                        link(i, it->second);
+                }
+            }
+    }
+}
+
+// write a binary scenario to out; with adjacency, the links are computed with grid_neighbors
+inline bool scenario_write(FILE *out, uint32_t x_max, uint32_t y_max, uint32_t end_time,
+                           const std::vector<scenario_node> &nodes, const std::vector<scenario_pair> &pairs, bool adjacency)
+{
+    uint32_t node_num = nodes.size();
+    std::vector<uint64_t> adj_index;
+    std::vector<uint32_t> adj_ids;
+    if (adjacency)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> edges; // both directions of every link
+        grid_neighbors(node_num, [&nodes](uint32_t i, double &x, double &y) { x = nodes[i].x; y = nodes[i].y; },
+                       [&edges](uint32_t i, uint32_t j) {
+                           edges.push_back(std::make_pair(i, j));
+                           edges.push_back(std::make_pair(j, i));
+                       });
+        std::sort(edges.begin(), edges.end());
+        adj_index.assign(node_num + 1, 0);
+        adj_ids.resize(edges.size());
+        for (size_t k = 0; k < edges.size(); k++)
+        {
+            adj_index[edges[k].first + 1]++;
+            adj_ids[k] = edges[k].second;
+        }
+        for (uint32_t i = 0; i < node_num; i++)
+            adj_index[i + 1] += adj_index[i];
+    }
+
+    scenario_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SCENARIO_MAGIC, sizeof(h.magic));
+    h.version = SCENARIO_VERSION;
+    h.flags = adjacency ? SCENARIO_ADJACENCY : 0;
+    h.node_num = node_num;
+    h.x_max = x_max;
+    h.y_max = y_max;
+    h.end_time = end_time;
+    h.pair_num = pairs.size();
+    h.edge_num = adj_ids.size();
+    h.node_offset = scenario_align(sizeof(h));
+    uint64_t offset = h.node_offset + (uint64_t)node_num * sizeof(scenario_node);
+    if (adjacency)
+    {
+        h.adj_index_offset = scenario_align(offset);
+        h.adj_ids_offset = scenario_align(h.adj_index_offset + adj_index.size() * sizeof(uint64_t));
+        offset = h.adj_ids_offset + adj_ids.size() * sizeof(uint32_t);
+    }
+    h.pair_offset = scenario_align(offset);
+
+    // write the sections in order, padding each one to its offset
+    uint64_t written = 0;
+    const char zeros[8] = {0};
+    bool ok = true;
+    auto put = [&](uint64_t at, const void *data, uint64_t len) {
+        ok = ok && fwrite(zeros, 1, at - written, out) == at - written && fwrite(data, 1, len, out) == len;
+        written = at + len;
+    };
+    put(0, &h, sizeof(h));
+    put(h.node_offset, nodes.data(), (uint64_t)node_num * sizeof(scenario_node));
+    if (adjacency)
+    {
+        put(h.adj_index_offset, adj_index.data(), adj_index.size() * sizeof(uint64_t));
+        put(h.adj_ids_offset, adj_ids.data(), adj_ids.size() * sizeof(uint32_t));
+    }
+    put(h.pair_offset, pairs.data(), pairs.size() * sizeof(scenario_pair));
+    return ok;
+}
+
+#endif
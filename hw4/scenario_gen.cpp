@@ -0,0 +1,338 @@
+// scenario_gen writes a random scenario for the homework simulators; the same options and seed
+// always give the same scenario
+// usage: scenario_gen [options] > scenario
+//   --nodes=n --degree=d --seed=s
+//   --placement=uniform|clustered|grid|corridor --clusters=k --aspect=a
+//   --traffic=uniform|hotspot|all-to-one --pairs=p --hotspots=h --hot-fraction=f --sink=id
+//   --hello=lo:hi --publish=lo:hi --traffic-start=t --traffic-gap=g --end=t
+//   --format=hw1|hw2|hw3|hw4|binary --adjacency --out=path --report
+// the field is sized so that a node has about d nodes within the radio range of 1 unit
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include "scenario_format.h"
+#include "option_format.h"
+
+using namespace std;
+
+class gen_options
+{
+public:
+    uint32_t nodes;
+    double degree;
+    uint64_t seed;
+    string placement;
+    uint32_t clusters;
+    double aspect; // length / width of a corridor
+    string traffic;
+    uint32_t pairs;
+    uint32_t hotspots;
+    double hot_fraction; // the share of the pairs sent to a hotspot
+    uint32_t sink;
+    uint32_t hello_lo, hello_hi;
+    uint32_t publish_lo, publish_hi;
+    uint32_t traffic_start; // 0 means 30 after the last publish
+    uint32_t traffic_gap;
+    uint32_t end_time; // 0 means 1000 after the last pair
+    string format;
+    bool adjacency;
+    string out;
+    bool report;
+
+    gen_options()
+        : nodes(1000), degree(10), seed(1), placement("uniform"), clusters(10), aspect(64), traffic("uniform"),
+          pairs(100), hotspots(1), hot_fraction(0.8), sink(0), hello_lo(10), hello_hi(200), publish_lo(210),
+          publish_hi(300), traffic_start(0), traffic_gap(20), end_time(0), format("hw4"), adjacency(false),
+          report(false)
+    {
+    }
+};
+
+// a splitmix64 generator; unlike the <random> distributions its output is the same on every platform
+class gen_random
+{
+    uint64_t state;
+
+public:
+    gen_random(uint64_t seed) : state(seed) {}
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (next() >> 11) * (1. / 9007199254740992.); } // [0, 1)
+    double uniform(double lo, double hi) { return lo + (hi - lo) * uniform(); }
+    uint32_t below(uint32_t n) { return (uint32_t)((next() >> 32) * n >> 32); }
+    uint32_t between(uint32_t lo, uint32_t hi) { return lo + below(hi - lo + 1); }
+};
+
+// the text scenarios have 4 decimals; the binary one is rounded the same way so both give the same run
+double round4(double v) { return round(v * 10000.) / 10000.; }
+
+// place the nodes; width and height are set to the size of the field
+bool place_nodes(const gen_options &o, gen_random &rnd, vector<scenario_node> &nodes, double &width, double &height)
+{
+    // a node has (density * pi) nodes within the radio range
+    double area = o.nodes * M_PI / o.degree;
+    nodes.resize(o.nodes);
+    if (o.placement == "uniform" || o.placement == "corridor")
+    {
+        width = height = sqrt(area);
+        if (o.placement == "corridor")
+        {
+            height = sqrt(area / o.aspect);
+            width = height * o.aspect;
+        }
+        for (uint32_t i = 0; i < o.nodes; i++)
+        {
+            nodes[i].x = round4(rnd.uniform(0, width));
+            nodes[i].y = round4(rnd.uniform(0, height));
+        }
+    }
+    else if (o.placement == "grid")
+    {
+        uint32_t columns = (uint32_t)ceil(sqrt((double)o.nodes));
+        double spacing = sqrt(M_PI / o.degree); // the degree of a lattice only takes a few values (4, 8, 12, ...)
+        width = columns * spacing;
+        height = ((o.nodes + columns - 1) / columns) * spacing;
+        for (uint32_t i = 0; i < o.nodes; i++)
+        {
+            nodes[i].x = round4((i % columns + 0.5) * spacing);
+            nodes[i].y = round4((i / columns + 0.5) * spacing);
+        }
+    }
+    else if (o.placement == "clustered")
+    {
+        // every cluster is a disk of the density above; the clusters cover a quarter of the field, so the
+        // degree is higher where they overlap
+        uint32_t clusters = o.clusters < o.nodes ? o.clusters : o.nodes;
+        double radius = sqrt(area / clusters / M_PI);
+        width = height = sqrt(4 * area) + 2 * radius;
+        vector<pair<double, double>> centers(clusters);
+        for (uint32_t c = 0; c < clusters; c++)
+            centers[c] = make_pair(rnd.uniform(radius, width - radius), rnd.uniform(radius, height - radius));
+        for (uint32_t i = 0; i < o.nodes; i++)
+        {
+            const pair<double, double> &c = centers[i % clusters];
+            double r = radius * sqrt(rnd.uniform()), a = rnd.uniform(0, 2 * M_PI);
+            nodes[i].x = round4(c.first + r * cos(a));
+            nodes[i].y = round4(c.second + r * sin(a));
+        }
+    }
+    else
+    {
+        cerr << "unknown placement " << o.placement << endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < o.nodes; i++)
+    {
+        nodes[i].hello_time = rnd.between(o.hello_lo, o.hello_hi);
+        nodes[i].publish_time = rnd.between(o.publish_lo, o.publish_hi);
+    }
+    return true;
+}
+
+bool make_traffic(const gen_options &o, gen_random &rnd, vector<scenario_pair> &pairs)
+{
+    if (o.traffic != "uniform" && o.traffic != "hotspot" && o.traffic != "all-to-one")
+    {
+        cerr << "unknown traffic pattern " << o.traffic << endl;
+        return false;
+    }
+    if (o.nodes < 2 || o.sink >= o.nodes)
+    {
+        cerr << "the traffic needs at least 2 nodes and a valid sink" << endl;
+        return false;
+    }
+    uint32_t start = o.traffic_start != 0 ? o.traffic_start : o.publish_hi + 30;
+    uint32_t hotspots = o.hotspots < o.nodes ? o.hotspots : o.nodes;
+    vector<uint32_t> hot(hotspots);
+    for (uint32_t h = 0; h < hotspots; h++)
+        hot[h] = rnd.below(o.nodes);
+    pairs.resize(o.pairs);
+    for (uint32_t i = 0; i < o.pairs; i++)
+    {
+        scenario_pair &p = pairs[i];
+        p.time = start + i * o.traffic_gap;
+        if (o.traffic == "all-to-one")
+            p.dst = o.sink;
+        else if (o.traffic == "hotspot" && rnd.uniform() < o.hot_fraction)
+            p.dst = hot[rnd.below(hotspots)];
+        else
+            p.dst = rnd.below(o.nodes);
+        do
+            p.src = rnd.below(o.nodes);
+        while (p.src == p.dst);
+    }
+    return true;
+}
+
+// the average number of physical neighbors
+double average_degree(const vector<scenario_node> &nodes)
+{
+    uint64_t links = 0;
+    grid_neighbors(nodes.size(), [&nodes](uint32_t i, double &x, double &y) { x = nodes[i].x; y = nodes[i].y; },
+                   [&links](uint32_t, uint32_t) { links++; });
+    return nodes.empty() ? 0 : 2. * links / nodes.size();
+}
+
+bool write_text(FILE *out, const gen_options &o, uint32_t x_max, uint32_t y_max, uint32_t end_time,
+                const vector<scenario_node> &nodes, const vector<scenario_pair> &pairs)
+{
+    bool hw1 = (o.format == "hw1");
+    if (o.format == "hw4")
+        fprintf(out, "%u %u %u\n", o.nodes, x_max, y_max);
+    else
+        fprintf(out, "%u\n", o.nodes);
+    for (uint32_t i = 0; i < o.nodes; i++)
+    {
+        if (hw1)
+            fprintf(out, "%u\t%.4f\t%.4f\n", i, nodes[i].x, nodes[i].y);
+        else if (o.format == "hw2")
+            fprintf(out, "%u %.4f %.4f\n", i, nodes[i].x, nodes[i].y);
+        else if (o.format == "hw3")
+            fprintf(out, "%u %.4f %.4f %u\n", i, nodes[i].x, nodes[i].y, nodes[i].hello_time);
+        else
+            fprintf(out, "%u %.4f %.4f %u %u\n", i, nodes[i].x, nodes[i].y, nodes[i].hello_time, nodes[i].publish_time);
+    }
+    if (hw1)
+        fprintf(out, "%u\n", o.pairs);
+    else
+        fprintf(out, "%u %u\n", o.pairs, end_time);
+    for (uint32_t i = 0; i < o.pairs; i++)
+    {
+        if (hw1)
+            fprintf(out, "%u\t%u\n", pairs[i].src, pairs[i].dst);
+        else
+            fprintf(out, "%u %u %u\n", pairs[i].time, pairs[i].src, pairs[i].dst);
+    }
+    return !ferror(out);
+}
+
+// "lo:hi" or a single value; false if either is not a number
+bool parse_range(const string &value, uint32_t &lo, uint32_t &hi)
+{
+    size_t colon = value.find(':');
+    if (!parse_number(value.substr(0, colon), lo))
+        return false;
+    if (colon == string::npos)
+    {
+        hi = lo;
+        return true;
+    }
+    return parse_number(value.substr(colon + 1), hi);
+}
+
+void print_usage(const char *program)
+{
+    cerr << "usage: " << program << " [options] > scenario" << endl
+         << "  nodes:    --nodes=n --degree=d --seed=s --placement=uniform|clustered|grid|corridor" << endl
+         << "            --clusters=k --aspect=a --hello=lo:hi --publish=lo:hi" << endl
+         << "  traffic:  --traffic=uniform|hotspot|all-to-one --pairs=p --hotspots=h --hot-fraction=f" << endl
+         << "            --sink=id --traffic-start=t --traffic-gap=g --end=t" << endl
+         << "  output:   --format=hw1|hw2|hw3|hw4|binary --adjacency --out=path --report" << endl;
+}
+
+bool parse_options(int argc, char *argv[], gen_options &o)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i], value;
+        bool bad = false; // a number option with a wrong value
+        if (option_number(arg, "nodes", o.nodes, bad) || option_number(arg, "degree", o.degree, bad) ||
+            option_number(arg, "seed", o.seed, bad) || option_number(arg, "clusters", o.clusters, bad) ||
+            option_number(arg, "aspect", o.aspect, bad) || option_number(arg, "pairs", o.pairs, bad) ||
+            option_number(arg, "hotspots", o.hotspots, bad) || option_number(arg, "hot-fraction", o.hot_fraction, bad) ||
+            option_number(arg, "sink", o.sink, bad) || option_number(arg, "traffic-start", o.traffic_start, bad) ||
+            option_number(arg, "traffic-gap", o.traffic_gap, bad) || option_number(arg, "end", o.end_time, bad))
+        {
+            // only a number; a wrong value is reported below
+        }
+        else if (option_value(arg, "placement", value))
+            o.placement = value;
+        else if (option_value(arg, "traffic", value))
+            o.traffic = value;
+        else if (option_value(arg, "hello", value))
+            bad = !parse_range(value, o.hello_lo, o.hello_hi);
+        else if (option_value(arg, "publish", value))
+            bad = !parse_range(value, o.publish_lo, o.publish_hi);
+        else if (option_value(arg, "format", value) &&
+                 (value == "hw1" || value == "hw2" || value == "hw3" || value == "hw4" || value == "binary"))
+            o.format = value;
+        else if (arg == "--adjacency")
+            o.adjacency = true;
+        else if (option_value(arg, "out", value))
+            o.out = value;
+        else if (arg == "--report")
+            o.report = true;
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            print_usage(argv[0]);
+            return false;
+        }
+        if (bad)
+        {
+            cerr << "wrong value in " << arg << endl;
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    // written as negations so that a nan is rejected too
+    if (!(o.degree > 0) || o.hello_lo > o.hello_hi || o.publish_lo > o.publish_hi || !(o.aspect >= 1))
+    {
+        cerr << "--degree should be positive, --aspect at least 1 and every range lo:hi should have lo <= hi" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    gen_options o;
+    if (!parse_options(argc, argv, o))
+        return 1;
+
+    // the nodes and the traffic use separate streams, so changing the traffic keeps the placement
+    gen_random node_rnd(o.seed), traffic_rnd(o.seed ^ 0x5851f42d4c957f2dULL);
+    vector<scenario_node> nodes;
+    vector<scenario_pair> pairs;
+    double width, height;
+    if (!place_nodes(o, node_rnd, nodes, width, height) || !make_traffic(o, traffic_rnd, pairs))
+        return 1;
+    if (width * 10000. >= 4294967295. || height * 10000. >= 4294967295.)
+    {
+        cerr << "the field (" << width << " x " << height << ") is too large for X_MAX and Y_MAX" << endl;
+        return 1;
+    }
+    uint32_t x_max = (uint32_t)ceil(width * 10000.), y_max = (uint32_t)ceil(height * 10000.);
+    uint32_t end_time = o.end_time;
+    if (end_time == 0)
+        end_time = (pairs.empty() ? o.publish_hi : pairs.back().time) + 1000;
+
+    FILE *out = o.out.empty() ? stdout : fopen(o.out.c_str(), "wb");
+    if (out == nullptr)
+    {
+        cerr << "cannot create " << o.out << endl;
+        return 1;
+    }
+    bool ok = (o.format == "binary") ? scenario_write(out, x_max, y_max, end_time, nodes, pairs, o.adjacency)
+                                     : write_text(out, o, x_max, y_max, end_time, nodes, pairs);
+    if (out != stdout)
+        ok = (fclose(out) == 0) && ok;
+    else
+        ok = (fflush(out) == 0) && ok;
+    if (!ok)
+    {
+        cerr << "cannot write the scenario" << endl;
+        return 1;
+    }
+    if (o.report)
+        cerr << o.nodes << " nodes on " << width << " x " << height << ", average degree " << average_degree(nodes)
+             << ", " << o.pairs << " pairs until " << end_time << endl;
+    return 0;
+}
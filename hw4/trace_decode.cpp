@@ -0,0 +1,158 @@
+// trace_decode prints a binary event log of hw4 in the text layout of hw4
+// usage: trace_decode [--pkt=id] [--node=id] [--from=time] [--to=time] trace.bin
+// with the index at the end of the log, the blocks which cannot match the filters are not read
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <climits>
+#include "trace_format.h"
+#include "option_format.h"
+
+using namespace std;
+
+class trace_filter
+{
+public:
+    unsigned int pktID;
+    unsigned int nodeID;
+    uint64_t from; // in the fixed-point times of the records; --to includes the whole tick
+    uint64_t to;
+    trace_filter() : pktID(UINT_MAX), nodeID(UINT_MAX), from(0), to(UINT64_MAX) {}
+
+    bool match(const trace_record &r) const
+    {
+        return (pktID == UINT_MAX || r.pktID == pktID) && (nodeID == UINT_MAX || r.nodeID == nodeID) &&
+               r.time >= from && r.time <= to;
+    }
+    bool may_match(const trace_block &b) const
+    {
+        if (b.last_time < from || b.first_time > to)
+            return false;
+        if (pktID != UINT_MAX && (pktID < b.min_pktID || pktID > b.max_pktID || !trace_bloom_test(b.pkt_bits, pktID)))
+            return false;
+        if (nodeID != UINT_MAX && !trace_bloom_test(b.node_bits, nodeID))
+            return false;
+        return true;
+    }
+};
+
+void print_record(const trace_record &r, string &out)
+{
+    char line[TRACE_LINE_MAX];
+    out.append(line, format_trace_line(line, r) - line);
+    if (out.size() >= (1 << 20))
+    {
+        fwrite(out.data(), 1, out.size(), stdout);
+        out.clear();
+    }
+}
+
+// print the matching records among record_num records starting at the first_record-th one
+bool decode_range(FILE *in, uint64_t first_record, uint64_t record_num, const trace_filter &filter, string &out)
+{
+    vector<trace_record> buf(TRACE_BLOCK_RECORDS);
+    if (fseeko(in, sizeof(trace_file_header) + first_record * sizeof(trace_record), SEEK_SET) != 0)
+        return false;
+    while (record_num > 0)
+    {
+        size_t n = record_num < buf.size() ? record_num : buf.size();
+        size_t got = fread(buf.data(), sizeof(trace_record), n, in);
+        for (size_t i = 0; i < got; i++)
+            if (filter.match(buf[i]))
+                print_record(buf[i], out);
+        if (got < n)
+            return false;
+        record_num -= n;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    trace_filter filter;
+    string path;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        unsigned int ticks = 0;
+        bool bad = false;
+        if (option_number(arg, "from", ticks, bad))
+            filter.from = (uint64_t)ticks << TRACE_TIME_FRAC_BITS;
+        else if (option_number(arg, "to", ticks, bad))
+            filter.to = (((uint64_t)ticks + 1) << TRACE_TIME_FRAC_BITS) - 1;
+        else if (!option_number(arg, "pkt", filter.pktID, bad) && !option_number(arg, "node", filter.nodeID, bad))
+        {
+            if (arg.compare(0, 2, "--") == 0 || !path.empty())
+                bad = true;
+            else
+                path = arg;
+        }
+        if (bad)
+        {
+            cerr << "usage: " << argv[0] << " [--pkt=id] [--node=id] [--from=time] [--to=time] trace.bin" << endl;
+            return 1;
+        }
+    }
+    FILE *in = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+    if (in == nullptr)
+    {
+        cerr << "cannot open " << (path.empty() ? "the trace file" : path) << endl;
+        return 1;
+    }
+
+    trace_file_header h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0)
+    {
+        cerr << path << " is not a binary trace of hw4" << endl;
+        return 1;
+    }
+    if (h.version != TRACE_VERSION || h.record_size != sizeof(trace_record))
+    {
+        cerr << path << ": unsupported trace version " << h.version << endl;
+        return 1;
+    }
+
+    string out;
+    trace_footer f;
+    fseeko(in, 0, SEEK_END);
+    off_t size = ftello(in);
+    bool indexed = size >= (off_t)(sizeof(h) + sizeof(f)) && fseeko(in, size - sizeof(f), SEEK_SET) == 0 &&
+                   fread(&f, sizeof(f), 1, in) == 1 && memcmp(f.magic, TRACE_INDEX_MAGIC, sizeof(f.magic)) == 0;
+    bool ok = true;
+    // the index lies between the records and the footer; its size is checked before it is allocated
+    uint64_t index_end = size - sizeof(f);
+    if (indexed && (f.index_offset < sizeof(h) || f.index_offset > index_end ||
+                    f.block_num > (index_end - f.index_offset) / sizeof(trace_block)))
+    {
+        cerr << path << ": the index does not fit in the log" << endl;
+        return 1;
+    }
+    if (indexed)
+    {
+        vector<trace_block> index(f.block_num);
+        fseeko(in, f.index_offset, SEEK_SET);
+        if (fread(index.data(), sizeof(trace_block), index.size(), in) != index.size())
+        {
+            cerr << path << ": the index is truncated" << endl;
+            return 1;
+        }
+        for (size_t i = 0; i < index.size() && ok; i++)
+            if (filter.may_match(index[i]))
+                ok = decode_range(in, index[i].first_record, index[i].record_num, filter, out);
+    }
+    else
+    {
+        // the log was not closed properly: scan every complete record
+        cerr << path << ": no index, scanning the whole log" << endl;
+        decode_range(in, 0, (size - sizeof(h)) / sizeof(trace_record), filter, out);
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fclose(in);
+    if (!ok)
+    {
+        cerr << path << ": the log is truncated" << endl;
+        return 1;
+    }
+    return 0;
+}
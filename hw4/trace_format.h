@@ -0,0 +1,185 @@
+// the binary event log written by "hw4 --trace-format=binary" and read by trace_decode
+//
+// file layout:
+//   trace_file_header
+//   trace_record * record_num          (in the order the events are triggered)
+//   trace_block  * block_num           (the index; one entry per TRACE_BLOCK_RECORDS records)
+//   trace_footer
+// all integers are stored in the byte order of the machine writing the log
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+
+const char TRACE_MAGIC[8] = {'G', 'R', 'T', 'R', 'A', 'C', 'E', '1'};
+const char TRACE_INDEX_MAGIC[8] = {'G', 'R', 'T', 'R', 'I', 'D', 'X', '1'};
+const uint32_t TRACE_VERSION = 2;
+const uint32_t TRACE_BLOCK_RECORDS = 4096;
+const unsigned int TRACE_TIME_FRAC_BITS = 16; // the times are fixed-point numbers of ticks with this many fractional bits
+
+// the role of the node in a record
+const uint8_t TRACE_RECV = 0; // "recID"
+const uint8_t TRACE_SEND = 1; // "senID"
+
+struct trace_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size; // sizeof(trace_record)
+};
+
+// one line of the text log
+struct trace_record
+{
+    uint64_t time;
+    uint32_t nodeID; // the receiver of a recv_event or the sender of a send_event
+    uint32_t pktID;
+    uint32_t srcID;
+    uint32_t dstID;
+    uint32_t preID;
+    uint32_t nexID;
+    uint8_t role;    // TRACE_RECV or TRACE_SEND
+    uint8_t pad[3];
+};
+
+// the summary of TRACE_BLOCK_RECORDS consecutive records; it lets a reader skip the blocks
+// which cannot match a filter on time, packet id or node id
+struct trace_block
+{
+    uint64_t first_record;
+    uint64_t first_time;
+    uint64_t last_time;
+    uint32_t record_num;
+    uint32_t min_pktID;
+    uint32_t max_pktID;
+    uint32_t pad;
+    uint64_t node_bits[4]; // a 256-bit Bloom filter of nodeID
+    uint64_t pkt_bits[4];  // a 256-bit Bloom filter of pktID
+};
+
+struct trace_footer
+{
+    uint64_t index_offset; // where the first trace_block starts
+    uint64_t block_num;
+    uint64_t record_num;
+    char magic[8];
+};
+
+// the bit of id in a 256-bit Bloom filter
+inline unsigned int trace_bloom_bit(uint32_t id)
+{
+    return (unsigned int)(((uint64_t)id * 0x9e3779b97f4a7c15ULL) >> 56);
+}
+inline void trace_bloom_add(uint64_t bits[4], uint32_t id)
+{
+    unsigned int b = trace_bloom_bit(id);
+    bits[b >> 6] |= 1ULL << (b & 63);
+}
+inline bool trace_bloom_test(const uint64_t bits[4], uint32_t id)
+{
+    unsigned int b = trace_bloom_bit(id);
+    return (bits[b >> 6] >> (b & 63)) & 1;
+}
+
+inline void trace_record_set(trace_record &r, uint64_t time, uint8_t role, uint32_t nodeID, uint32_t pktID, uint32_t srcID,
+                             uint32_t dstID, uint32_t preID, uint32_t nexID)
+{
+    r.time = time;
+    r.nodeID = nodeID;
+    r.pktID = pktID;
+    r.srcID = srcID;
+    r.dstID = dstID;
+    r.preID = preID;
+    r.nexID = nexID;
+    r.role = role;
+    r.pad[0] = r.pad[1] = r.pad[2] = 0;
+}
+
+inline void trace_block_reset(trace_block &b, uint64_t first_record)
+{
+    memset(&b, 0, sizeof(b));
+    b.first_record = first_record;
+    b.min_pktID = UINT32_MAX;
+}
+inline void trace_block_add(trace_block &b, const trace_record &r)
+{
+    if (b.record_num == 0)
+        b.first_time = r.time;
+    b.last_time = r.time;
+    b.record_num++;
+    if (r.pktID < b.min_pktID)
+        b.min_pktID = r.pktID;
+    if (r.pktID > b.max_pktID)
+        b.max_pktID = r.pktID;
+    trace_bloom_add(b.node_bits, r.nodeID);
+    trace_bloom_add(b.pkt_bits, r.pktID);
+}
+
+
+// the text log: "time t   recID n   pktID n ..." with every field right-aligned, as hw4 prints it
+// and trace_decode prints a binary log back; TRACE_LINE_MAX bytes are enough for one line
+const int TRACE_LINE_MAX = 192;
+
+// append v right-aligned in a field of width characters
+inline char *format_uint(char *p, unsigned long long v, int width)
+{
+    char digits[20];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    for (int i = n; i < width; i++)
+        *p++ = ' ';
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+inline char *format_str(char *p, const char *str)
+{
+    while (*str != '\0')
+        *p++ = *str++;
+    return p;
+}
+
+// append the time t, right-aligned in a field of width characters: the whole ticks, followed by
+// the decimal fraction if there is one
+inline char *format_time(char *p, uint64_t t, int width)
+{
+    const uint64_t one = (uint64_t)1 << TRACE_TIME_FRAC_BITS;
+    uint64_t frac = t & (one - 1);
+    if (frac == 0)
+        return format_uint(p, t >> TRACE_TIME_FRAC_BITS, width);
+    char digits[TRACE_TIME_FRAC_BITS + 1];
+    int n = 0;
+    while (frac != 0)
+    {
+        frac *= 10;
+        digits[n++] = '0' + (frac >> TRACE_TIME_FRAC_BITS);
+        frac &= one - 1;
+    }
+    p = format_uint(p, t >> TRACE_TIME_FRAC_BITS, width - n - 1);
+    *p++ = '.';
+    for (int i = 0; i < n; i++)
+        *p++ = digits[i];
+    return p;
+}
+
+// append the line of r with its newline
+inline char *format_trace_line(char *p, const trace_record &r)
+{
+    p = format_time(format_str(p, "time "), r.time, 11);
+    p = format_uint(format_str(p, r.role == TRACE_SEND ? "   senID " : "   recID "), r.nodeID, 11);
+    p = format_uint(format_str(p, "   pktID"), r.pktID, 11);
+    p = format_uint(format_str(p, "   srcID "), r.srcID, 11);
+    p = format_uint(format_str(p, "   dstID"), r.dstID, 11);
+    p = format_uint(format_str(p, "   preID"), r.preID, 11);
+    p = format_uint(format_str(p, "   nexID"), r.nexID, 11);
+    *p++ = '\n';
+    return p;
+}
+
+#endif